@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "access_log.h"
+
+std::atomic<access_log::log_ring*> access_log::m_rings( NULL );
+access_log::log_ring* access_log::m_free_rings = NULL;
+locker access_log::m_free_lock;
+
+struct access_log::ring_owner
+{
+    log_ring* ring;
+    ~ring_owner(){
+        if( ring ){
+            m_free_lock.lock();
+            ring->free_next = m_free_rings;
+            m_free_rings = ring;
+            m_free_lock.unlock();
+        }
+    }
+};
+std::atomic<bool> access_log::m_running( false );
+std::atomic<uint64_t> access_log::m_written( 0 );
+pthread_t access_log::m_thread;
+int access_log::m_fd = -1;
+char access_log::m_path[256];
+size_t access_log::m_rotate_size = 0;
+int access_log::m_keep = 0;
+size_t access_log::m_file_size = 0;
+
+static const size_t BATCH_SIZE = 256 * 1024;    //后台线程攒够这么多字节或缓冲区都取空时写一次
+static const size_t MAX_LINE = 1024;            //一条记录格式化后的最大长度（URL转义后最多变为4倍）
+static const int IDLE_SLEEP_MS = 10;            //没有记录时的休眠时间
+
+bool access_log::start( const char* path, size_t rotate_size, int keep ){
+    if( m_running.load() ){
+        return false;
+    }
+    snprintf( m_path, sizeof( m_path ), "%s", path );
+    m_rotate_size = rotate_size;
+    m_keep = keep;
+    m_fd = open( m_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if( m_fd < 0 ){
+        return false;
+    }
+    off_t size = lseek( m_fd, 0, SEEK_END );
+    m_file_size = size > 0 ? size : 0;
+    m_running.store( true );
+    if( pthread_create( &m_thread, NULL, run, NULL ) != 0 ){
+        m_running.store( false );
+        close( m_fd );
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void access_log::stop(){
+    if( !m_running.exchange( false ) ){
+        return;
+    }
+    pthread_join( m_thread, NULL );
+    close( m_fd );
+    m_fd = -1;
+}
+
+access_log::log_ring* access_log::local(){
+    static thread_local log_ring* ring = NULL;
+    static thread_local ring_owner owner = {NULL};
+    if( !ring ){
+        // 先复用已退出线程的环形缓冲区，后台线程从它原来的位置继续读
+        m_free_lock.lock();
+        ring = m_free_rings;
+        if( ring ){
+            m_free_rings = ring->free_next;
+        }
+        m_free_lock.unlock();
+        if( ring ){
+            owner.ring = ring;
+            return ring;
+        }
+        ring = new log_ring;
+        ring->head.store( 0, std::memory_order_relaxed );
+        ring->tail.store( 0, std::memory_order_relaxed );
+        ring->dropped.store( 0, std::memory_order_relaxed );
+        log_ring* head = m_rings.load( std::memory_order_relaxed );
+        do{
+            ring->next = head;
+        }while( !m_rings.compare_exchange_weak( head, ring, std::memory_order_release, std::memory_order_relaxed ) );
+        owner.ring = ring;
+    }
+    return ring;
+}
+
+void access_log::record( const access_record& rec ){
+    if( !enabled() ){
+        return;
+    }
+    log_ring* ring = local();
+    uint64_t tail = ring->tail.load( std::memory_order_relaxed );
+    if( tail - ring->head.load( std::memory_order_acquire ) >= ( uint64_t )log_ring::CAPACITY ){
+        // 后台线程跟不上，丢弃而不是等待
+        ring->dropped.store( ring->dropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        return;
+    }
+    ring->records[ tail & ( log_ring::CAPACITY - 1 ) ] = rec;
+    ring->tail.store( tail + 1, std::memory_order_release );
+}
+
+uint64_t access_log::dropped(){
+    uint64_t total = 0;
+    for( log_ring* ring = m_rings.load( std::memory_order_acquire ); ring; ring = ring->next ){
+        total += ring->dropped.load( std::memory_order_relaxed );
+    }
+    return total;
+}
+
+// URL来自客户端，其中的"、\和不可打印字节写成\xHH，客户端无法伪造字段或换行；返回写入的长度，out至少4 * strlen(url) + 1字节
+static size_t escape_url( const char* url, char* out ){
+    static const char hex[] = "0123456789abcdef";
+    char* p = out;
+    for( ; *url; url++ ){
+        unsigned char c = *url;
+        if( c < 0x20 || c >= 0x7f || c == '"' || c == '\\' ){
+            *p++ = '\\';
+            *p++ = 'x';
+            *p++ = hex[ c >> 4 ];
+            *p++ = hex[ c & 15 ];
+        }
+        else{
+            *p++ = c;
+        }
+    }
+    *p = '\0';
+    return p - out;
+}
+
+// 按Common Log Format附加耗时：127.0.0.1:port - - [17/Oct/2026:10:00:00 +0800] "GET /index.html" 200 27840 35us
+static size_t format_record( const access_record& rec, char* out, size_t cap ){
+    // 同一秒内的记录复用格式化好的时间，只有后台线程调用
+    static time_t cached_sec = -1;
+    static char cached_time[64];
+    time_t sec = rec.time_ms / 1000;
+    if( sec != cached_sec ){
+        struct tm tm;
+        localtime_r( &sec, &tm );
+        strftime( cached_time, sizeof( cached_time ), "%d/%b/%Y:%H:%M:%S %z", &tm );
+        cached_sec = sec;
+    }
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = rec.addr;
+    inet_ntop( AF_INET, &in, addr, sizeof( addr ) );
+    char url[ sizeof( rec.url ) * 4 ];
+    escape_url( rec.url, url );
+    int len = snprintf( out, cap, "%s:%u - - [%s] \"%s %s\" %u %llu %uus\n", addr, ntohs( rec.port ), cached_time,
+                        rec.method, url, rec.status, ( unsigned long long )rec.bytes, rec.latency_us );
+    return len < 0 ? 0 : ( ( size_t )len < cap ? len : cap - 1 );
+}
+
+size_t access_log::drain( log_ring* ring, char* buf, size_t len, size_t cap ){
+    uint64_t head = ring->head.load( std::memory_order_relaxed );
+    uint64_t tail = ring->tail.load( std::memory_order_acquire );
+    for( ; head < tail; head++ ){
+        if( cap - len < MAX_LINE ){
+            flush( buf, len );
+            len = 0;
+        }
+        len += format_record( ring->records[ head & ( log_ring::CAPACITY - 1 ) ], buf + len, cap - len );
+    }
+    // 记录格式化完才归还槽位
+    ring->head.store( head, std::memory_order_release );
+    return len;
+}
+
+void access_log::flush( const char* buf, size_t len ){
+    size_t done = 0;
+    while( done < len ){
+        ssize_t n = ::write( m_fd, buf + done, len - done );
+        if( n <= 0 ){
+            break;  //磁盘满等错误时放弃这一批
+        }
+        done += n;
+    }
+    m_file_size += done;
+    if( m_rotate_size > 0 && m_file_size >= m_rotate_size ){
+        rotate();
+    }
+}
+
+// path.(keep-1)被覆盖，path.i -> path.(i+1)，path -> path.1，然后重新创建path
+void access_log::rotate(){
+    char from[300], to[300];
+    for( int i = m_keep - 1; i >= 1; i-- ){
+        snprintf( from, sizeof( from ), "%s.%d", m_path, i );
+        snprintf( to, sizeof( to ), "%s.%d", m_path, i + 1 );
+        rename( from, to );
+    }
+    if( m_keep > 0 ){
+        snprintf( to, sizeof( to ), "%s.1", m_path );
+        rename( m_path, to );
+    }
+    else{
+        unlink( m_path );
+    }
+    int fd = open( m_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if( fd >= 0 ){
+        close( m_fd );
+        m_fd = fd;
+    }
+    m_file_size = 0;
+}
+
+void* access_log::run( void* arg ){
+    char* buf = new char[ BATCH_SIZE ];
+    while( true ){
+        bool running = m_running.load( std::memory_order_acquire );
+        size_t len = 0;
+        uint64_t before = 0, after = 0;
+        for( log_ring* ring = m_rings.load( std::memory_order_acquire ); ring; ring = ring->next ){
+            before += ring->head.load( std::memory_order_relaxed );
+            len = drain( ring, buf, len, BATCH_SIZE );
+            after += ring->head.load( std::memory_order_relaxed );
+        }
+        if( len > 0 ){
+            flush( buf, len );
+        }
+        m_written.fetch_add( after - before, std::memory_order_relaxed );
+        if( after == before ){
+            // 停止前最后一轮已经取空
+            if( !running ){
+                break;
+            }
+            struct timespec ts = {0, IDLE_SLEEP_MS * 1000000L};
+            nanosleep( &ts, NULL );
+        }
+    }
+    delete [] buf;
+    return NULL;
+}
@@ -0,0 +1,74 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <atomic>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mpmc_queue.h"
+#include "locker.h"
+
+/*
+访问日志中的一条记录，由工作线程填写，后台线程格式化
+*/
+struct access_record
+{
+    int64_t time_ms;            //请求处理完的墙上时间
+    uint32_t addr;              //客户端地址（网络字节序）
+    uint16_t port;              //客户端端口（网络字节序）
+    uint16_t status;            //响应状态码
+    uint32_t latency_us;        //从读到请求到生成响应的耗时
+    uint64_t bytes;             //响应的字节数（响应头+响应体）
+    char method[8];
+    char url[128];              //超长的URL被截断
+};
+
+/*
+异步访问日志：每个线程一个单生产者单消费者的环形缓冲区，工作线程只做一次拷贝，
+后台线程批量取出、格式化后用大块write写入文件，文件超过rotate_size时按 path -> path.1 -> path.2 ... 轮转。
+环形缓冲区满时丢弃记录并计数，不会阻塞工作线程。
+线程退出后它的环形缓冲区（可能还有未写出的记录）放进空闲链表，由之后新建的线程接着使用，缓冲区数不随线程池扩缩容增长。
+*/
+class access_log
+{
+public:
+    static bool start(const char* path, size_t rotate_size = 64 << 20, int keep = 4); //打开日志文件并启动后台线程
+    static void stop();                     //写完所有缓冲的记录后停止后台线程
+    static bool enabled() {return m_running.load(std::memory_order_relaxed);}
+    static void record(const access_record& rec);   //写入本线程的环形缓冲区
+    static uint64_t written() {return m_written.load(std::memory_order_relaxed);}
+    static uint64_t dropped();              //所有线程因缓冲区满而丢弃的记录数
+
+private:
+    struct alignas(CACHE_LINE_SIZE) log_ring
+    {
+        static const int CAPACITY = 1024;   //必须是2的幂
+        access_record records[CAPACITY];
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;    //后台线程读到的位置
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;    //所属线程写到的位置
+        std::atomic<uint64_t> dropped;
+        log_ring* next;
+        log_ring* free_next;                //空闲链表，所属线程退出后使用
+    };
+    struct ring_owner;                      //线程退出时把环形缓冲区放回空闲链表
+
+    static log_ring* local();
+    static void* run(void* arg);            //后台线程
+    static size_t drain(log_ring* ring, char* buf, size_t len, size_t cap);
+    static void flush(const char* buf, size_t len);
+    static void rotate();
+
+    static std::atomic<log_ring*> m_rings;
+    static log_ring* m_free_rings;
+    static locker m_free_lock;
+    static std::atomic<bool> m_running;
+    static std::atomic<uint64_t> m_written;
+    static pthread_t m_thread;
+    static int m_fd;
+    static char m_path[256];
+    static size_t m_rotate_size;
+    static int m_keep;
+    static size_t m_file_size;
+};
+
+#endif
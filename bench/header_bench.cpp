@@ -0,0 +1,215 @@
+/*
+响应头生成基准测试：比较原来逐个字段调用vsnprintf的add_*链，
+和编译期生成的片段 + memcpy + 查表itoa（header_template.h）生成同样的响应头的耗时。
+场景：缓存命中的200文件响应、404错误页、/__stats的200响应、单区间206响应。
+用法: ./bench/header_bench [每个场景的次数]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "../header_template.h"
+
+static const int BUFFER_SIZE = 1024;
+
+constexpr char ok_200_title[] = "200 OK";
+constexpr char ok_206_title[] = "206 Partial Content";
+constexpr char error_404_title[] = "404 Not Found";
+constexpr char error_404_form[] = "The requested file was not found on this server.\n";
+// 文件缓存预生成的200响应头
+static const char file_header[] = "HTTP/1.1 200 OK\r\nContent-Length: 27755\r\nContent-Type:text/html\r\n"
+                                  "ETag: \"172bfedf8eed9e00-6c6b\"\r\nLast-Modified: Tue, 29 Nov 2022 07:52:03 GMT\r\nAccept-Ranges: bytes\r\n";
+static const int fields_start = 64;
+
+// 原http_conn中的add_*链
+struct printf_builder
+{
+    char buf[BUFFER_SIZE];
+    int idx;
+    bool linger;
+
+    bool add_response(const char* format, ...){
+        if( idx >= BUFFER_SIZE ){
+            return false;
+        }
+        va_list arg_list;
+        va_start( arg_list, format );
+        int len = vsnprintf( buf + idx, BUFFER_SIZE - 1 - idx, format, arg_list );
+        va_end( arg_list );
+        if( len >= ( BUFFER_SIZE - 1 - idx ) ){
+            return false;
+        }
+        idx += len;
+        return true;
+    }
+    bool add_status_line(const char* title){ return add_response( "%s %s\r\n", "HTTP/1.1", title ); }
+    bool add_content_length(long long len){ return add_response( "Content-Length: %lld\r\n", len ); }
+    bool add_content_type(){ return add_response( "Content-Type:%s\r\n", "text/html" ); }
+    bool add_linger(){ return add_response( "Connection: %s\r\n", linger ? "keep-alive" : "close" ); }
+    bool add_blank_line(){ return add_response( "%s", "\r\n" ); }
+    bool add_content(const char* content){ return add_response( "%s", content ); }
+    bool add_headers(long long len){
+        bool a = add_content_length( len );
+        bool b = add_content_type();
+        bool c = add_linger();
+        bool d = add_blank_line();
+        return a && b && c && d;
+    }
+
+    void file(){
+        memcpy( buf + idx, file_header, sizeof( file_header ) - 1 );
+        idx += sizeof( file_header ) - 1;
+        add_linger();
+        add_blank_line();
+    }
+    void not_found(){
+        add_status_line( error_404_title );
+        add_headers( strlen( error_404_form ) );
+        add_content( error_404_form );
+    }
+    void stats( long long len ){
+        add_status_line( ok_200_title );
+        add_content_length( len );
+        add_response( "Content-Type:%s\r\n", "text/plain; version=0.0.4" );
+        add_linger();
+        add_blank_line();
+    }
+    void range( long long start, long long end, long long size ){
+        add_status_line( ok_206_title );
+        add_content_length( end - start + 1 );
+        add_response( "Content-Range: bytes %lld-%lld/%lld\r\n", start, end, size );
+        add_response( "Content-Type:%s\r\n", "text/html" );
+        add_response( "%.*s", ( int )( sizeof( file_header ) - 1 - fields_start ), file_header + fields_start );
+        add_linger();
+        add_blank_line();
+    }
+};
+
+template< size_t T >
+static constexpr auto status_line( const char ( &title )[T] ){
+    return join( literal( "HTTP/1.1 " ), literal( title ), literal( "\r\n" ) );
+}
+static constexpr auto status_200 = status_line( ok_200_title );
+static constexpr auto status_206 = status_line( ok_206_title );
+static constexpr auto error_404_head = join( status_line( error_404_title ), literal( "Content-Length: " ),
+                                             decimal< sizeof( error_404_form ) - 1 >(), literal( "\r\nContent-Type:text/html\r\n" ) );
+static constexpr auto keep_alive_end = literal( "Connection: keep-alive\r\n\r\n" );
+static constexpr auto close_end = literal( "Connection: close\r\n\r\n" );
+static constexpr auto content_length_field = literal( "Content-Length: " );
+static constexpr auto content_range_field = literal( "Content-Range: bytes " );
+static constexpr auto crlf = literal( "\r\n" );
+
+// 现在http_conn中的做法
+struct template_builder
+{
+    char buf[BUFFER_SIZE];
+    int idx;
+    bool linger;
+
+    bool add_bytes(const char* data, size_t len){
+        if( idx + len >= ( size_t )BUFFER_SIZE ){
+            return false;
+        }
+        memcpy( buf + idx, data, len );
+        idx += len;
+        return true;
+    }
+    template< size_t N >
+    bool add_bytes(const const_bytes< N >& bytes){ return add_bytes( bytes.data, N ); }
+    bool add_number(unsigned long long v){
+        if( idx + 20 >= BUFFER_SIZE ){
+            return false;
+        }
+        idx += write_decimal( buf + idx, v );
+        return true;
+    }
+    bool add_linger(){ return linger ? add_bytes( keep_alive_end ) : add_bytes( close_end ); }
+    bool add_content_length(long long len){ return add_bytes( content_length_field ) && add_number( len ) && add_bytes( crlf ); }
+
+    void file(){
+        add_bytes( file_header, sizeof( file_header ) - 1 );
+        add_linger();
+    }
+    void not_found(){
+        add_bytes( error_404_head );
+        add_linger();
+        add_bytes( error_404_form, sizeof( error_404_form ) - 1 );
+    }
+    void stats( long long len ){
+        add_bytes( status_200 );
+        add_content_length( len );
+        add_bytes( literal( "Content-Type:text/plain; version=0.0.4\r\n" ) );
+        add_linger();
+    }
+    void range( long long start, long long end, long long size ){
+        add_bytes( status_206 );
+        add_content_length( end - start + 1 );
+        add_bytes( content_range_field );
+        add_number( start );
+        add_bytes( "-", 1 );
+        add_number( end );
+        add_bytes( "/", 1 );
+        add_number( size );
+        add_bytes( crlf );
+        add_bytes( "Content-Type:", 13 );
+        add_bytes( "text/html", 9 );
+        add_bytes( crlf );
+        add_bytes( file_header + fields_start, sizeof( file_header ) - 1 - fields_start );
+        add_linger();
+    }
+};
+
+static double now_sec(){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile int sink;   //防止编译器删掉生成的结果
+
+// 每次生成一个响应头，返回平均耗时(ns)
+template< typename B >
+static double run( B& b, int scenario, long iterations ){
+    double start = now_sec();
+    for( long i = 0; i < iterations; i++ ){
+        b.idx = 0;
+        b.linger = i & 1;
+        switch( scenario ){
+            case 0: b.file(); break;
+            case 1: b.not_found(); break;
+            case 2: b.stats( 7000 + ( i & 1023 ) ); break;
+            default: b.range( i & 4095, ( i & 4095 ) + 99, 27755 ); break;
+        }
+        sink += b.buf[ b.idx - 3 ];
+    }
+    return ( now_sec() - start ) * 1e9 / iterations;
+}
+
+int main( int argc, char* argv[] ){
+    long iterations = argc > 1 ? atol( argv[1] ) : 5000000;
+    static const char* names[] = {"200 file", "404 error", "200 stats", "206 range"};
+    printf_builder a;
+    template_builder b;
+    printf( "%-12s %16s %16s %10s\n", "response", "add_* ns/op", "template ns/op", "speedup" );
+    for( int s = 0; s < 4; s++ ){
+        // 两种做法生成的字节必须相同
+        a.idx = b.idx = 0;
+        a.linger = b.linger = true;
+        switch( s ){
+            case 0: a.file(); b.file(); break;
+            case 1: a.not_found(); b.not_found(); break;
+            case 2: a.stats( 7000 ); b.stats( 7000 ); break;
+            default: a.range( 100, 199, 27755 ); b.range( 100, 199, 27755 ); break;
+        }
+        if( a.idx != b.idx || memcmp( a.buf, b.buf, a.idx ) != 0 ){
+            printf( "%s: output differs\n", names[s] );
+            return 1;
+        }
+        double old_ns = run( a, s, iterations );
+        double new_ns = run( b, s, iterations );
+        printf( "%-12s %16.1f %16.1f %9.1fx\n", names[s], old_ns, new_ns, old_ns / new_ns );
+    }
+    return 0;
+}
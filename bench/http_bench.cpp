@@ -0,0 +1,625 @@
+/*
+HTTP压测工具：多线程，每个线程一个epoll实例驱动一组非阻塞连接，结果以一行JSON输出
+    闭环（closed）：每个连接始终保持pipeline个未完成的请求，收到一个响应就发下一个，测最大吞吐
+    开环（open）：  按固定速率（-r，所有线程合计）产生请求，延迟从计划发出的时刻算起，
+                   服务器变慢时排队等待的时间也计入延迟，不会因为客户端跟着变慢而低估（coordinated omission）
+延迟用HDR风格的对数-线性直方图统计（每个2的幂区间128个子桶，相对误差<1%），报告p50/p90/p99/p999。
+建连速率：-k 0时每个请求一个新连接，另外报告每秒建立的连接数和connect耗时的分布；
+         监听队列溢出时SYN被丢弃，客户端1秒后重传，表现为connect耗时的p99/max超过1秒。
+用法: ./bench/http_bench [-h ip] [-p port] [-t 线程数] [-c 连接数] [-d 秒] [-w 预热秒]
+                         [-m closed|open] [-r 每秒请求数] [-k 0|1] [-P 流水线深度] [-u url]...
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_URLS 8
+#define MAX_DEPTH 64            //流水线深度上限
+#define HEADER_MAX 4096         //响应头最大长度
+#define OUT_MAX 8192            //每个连接待发送请求的缓冲区
+#define OPEN_BACKLOG (1 << 20)  //开环模式下每个线程最多排队的未发出请求数
+
+static inline long long now_us(){
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+对数-线性直方图：小于128us的值精确记录，更大的值按最高位分段，每段64个子桶
+*/
+struct histogram
+{
+    static const int SUB_BITS = 7;
+    static const int HALF = 1 << ( SUB_BITS - 1 );
+    static const int BUCKETS = 64 * HALF;
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    long long max;
+    double sum;
+
+    histogram(){ reset(); }
+    void reset(){
+        memset( counts, 0, sizeof( counts ) );
+        total = 0;
+        max = 0;
+        sum = 0;
+    }
+    static int index( long long v ){
+        if( v < ( 1 << SUB_BITS ) ){
+            return v < 0 ? 0 : ( int )v;
+        }
+        int msb = 63 - __builtin_clzll( v );
+        int shift = msb - ( SUB_BITS - 1 );
+        return ( shift + 1 ) * HALF + ( int )( v >> shift ) - HALF;
+    }
+    static long long value( int idx ){  //桶的上界
+        if( idx < ( 1 << SUB_BITS ) ){
+            return idx;
+        }
+        int shift = idx / HALF - 1;
+        long long sub = idx % HALF + HALF;
+        return ( ( sub + 1 ) << shift ) - 1;
+    }
+    void record( long long v ){
+        int idx = index( v );
+        if( idx >= BUCKETS ){
+            idx = BUCKETS - 1;
+        }
+        counts[idx]++;
+        total++;
+        sum += v;
+        if( v > max ){
+            max = v;
+        }
+    }
+    void merge( const histogram& o ){
+        for( int i = 0; i < BUCKETS; i++ ){
+            counts[i] += o.counts[i];
+        }
+        total += o.total;
+        sum += o.sum;
+        if( o.max > max ){
+            max = o.max;
+        }
+    }
+    long long percentile( double p ) const {
+        if( total == 0 ){
+            return 0;
+        }
+        uint64_t rank = ( uint64_t )( p / 100.0 * total );
+        if( rank >= total ){
+            rank = total - 1;
+        }
+        uint64_t seen = 0;
+        for( int i = 0; i < BUCKETS; i++ ){
+            seen += counts[i];
+            if( seen > rank ){
+                long long v = value( i );
+                return v < max ? v : max;
+            }
+        }
+        return max;
+    }
+};
+
+struct options
+{
+    const char* ip;
+    int port;
+    int threads;
+    int connections;
+    double duration;
+    double warmup;
+    bool open_loop;
+    double rate;
+    bool keepalive;
+    int depth;
+    const char* urls[MAX_URLS];
+    int url_count;
+};
+static options opt;
+
+static char requests[MAX_URLS][512];   //预先生成的请求报文
+static int request_lens[MAX_URLS];
+
+enum CONN_STATE {CONN_CONNECTING = 0, CONN_HEADER, CONN_BODY, CONN_DRAIN};
+
+struct bench_conn
+{
+    int fd;
+    CONN_STATE state;
+    long long connect_start;        //发起connect的时刻
+    long long starts[MAX_DEPTH];    //未完成请求的开始时间，环形队列
+    int head;
+    int outstanding;
+    char out[OUT_MAX];              //尚未写出的请求
+    int out_len;
+    int out_off;
+    bool want_out;                  //epoll中是否注册了EPOLLOUT
+    char header[HEADER_MAX];
+    int header_len;
+    long long body_left;
+    int status;
+};
+
+struct worker_ctx
+{
+    int id;
+    int epollfd;
+    bench_conn* conns;
+    int conn_count;
+    unsigned next_url;
+    long long record_from;          //预热结束的时刻
+    long long end;
+    histogram hist;
+    histogram connect_hist;         //connect发起到连接建立的耗时
+    uint64_t connected;             //统计区间内建立的连接数
+    uint64_t completed;
+    uint64_t errors;                //连接失败、读写错误、连接被提前关闭导致丢失的请求
+    uint64_t non_2xx;
+    uint64_t bytes;
+    uint64_t connects;
+    // 开环模式：按计划时刻排队等待发出的请求
+    long long interval_ns;
+    long long next_due_ns;
+    long long* backlog;
+    uint64_t backlog_head;
+    uint64_t backlog_tail;
+    uint64_t dropped;               //排队超过OPEN_BACKLOG而丢弃的请求
+    pthread_t thread;
+};
+
+// 只在是否需要EPOLLOUT发生变化时才调用epoll_ctl
+static void set_events( worker_ctx* w, bench_conn* c, bool add ){
+    bool want_out = c->state == CONN_CONNECTING || c->out_off < c->out_len;
+    if( !add && want_out == c->want_out ){
+        return;
+    }
+    c->want_out = want_out;
+    epoll_event ev;
+    ev.data.ptr = c;
+    ev.events = EPOLLIN | EPOLLRDHUP | ( want_out ? EPOLLOUT : 0 );
+    epoll_ctl( w->epollfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ev );
+}
+
+static bool open_conn( worker_ctx* w, bench_conn* c ){
+    c->fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    if( c->fd < 0 ){
+        return false;
+    }
+    int one = 1;
+    setsockopt( c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+    sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( opt.port );
+    inet_pton( AF_INET, opt.ip, &addr.sin_addr );
+    if( connect( c->fd, ( sockaddr* )&addr, sizeof( addr ) ) < 0 && errno != EINPROGRESS ){
+        close( c->fd );
+        c->fd = -1;
+        return false;
+    }
+    c->state = CONN_CONNECTING;
+    c->connect_start = now_us();
+    c->head = c->outstanding = 0;
+    c->out_len = c->out_off = 0;
+    c->header_len = 0;
+    w->connects++;
+    set_events( w, c, true );
+    return true;
+}
+
+// 关闭连接，未完成的请求计为错误
+static void close_conn( worker_ctx* w, bench_conn* c, bool failed ){
+    if( c->fd >= 0 ){
+        close( c->fd );
+        c->fd = -1;
+    }
+    if( failed ){
+        w->errors += c->outstanding;
+    }
+    c->outstanding = 0;
+}
+
+// 把一个请求放入连接的发送缓冲区，start为计算延迟的起点
+static bool queue_request( worker_ctx* w, bench_conn* c, long long start ){
+    const int u = w->next_url++ % opt.url_count;
+    if( c->outstanding == MAX_DEPTH || c->out_len + request_lens[u] > OUT_MAX ){
+        return false;
+    }
+    memcpy( c->out + c->out_len, requests[u], request_lens[u] );
+    c->out_len += request_lens[u];
+    c->starts[ ( c->head + c->outstanding ) % MAX_DEPTH ] = start;
+    c->outstanding++;
+    return true;
+}
+
+static bool flush( worker_ctx* w, bench_conn* c ){
+    while( c->out_off < c->out_len ){
+        ssize_t n = send( c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL );
+        if( n < 0 ){
+            if( errno == EAGAIN ){
+                break;
+            }
+            return false;
+        }
+        c->out_off += n;
+    }
+    if( c->out_off == c->out_len ){
+        c->out_off = c->out_len = 0;
+    }
+    set_events( w, c, false );
+    return true;
+}
+
+// 连接还能再接受的请求数：非keep-alive时每个连接只发一个请求
+static int capacity( bench_conn* c ){
+    if( c->fd < 0 || c->state == CONN_DRAIN ){
+        return 0;
+    }
+    int depth = opt.keepalive ? opt.depth : 1;
+    if( !opt.keepalive && c->outstanding > 0 ){
+        return 0;
+    }
+    return depth - c->outstanding;
+}
+
+// 开环模式下把到期的请求分给有空位的连接
+static void dispatch_backlog( worker_ctx* w ){
+    for( int i = 0; i < w->conn_count && w->backlog_head < w->backlog_tail; i++ ){
+        bench_conn* c = &w->conns[ ( w->next_url + i ) % w->conn_count ];
+        if( c->fd < 0 && !open_conn( w, c ) ){
+            continue;
+        }
+        bool queued = false;
+        for( int k = capacity( c ); k > 0 && w->backlog_head < w->backlog_tail; k-- ){
+            if( !queue_request( w, c, w->backlog[ w->backlog_head % OPEN_BACKLOG ] ) ){
+                break;
+            }
+            w->backlog_head++;
+            queued = true;
+        }
+        if( queued && c->state != CONN_CONNECTING && !flush( w, c ) ){
+            close_conn( w, c, true );
+        }
+    }
+}
+
+// 闭环模式下让连接保持满的流水线
+static void refill( worker_ctx* w, bench_conn* c ){
+    if( opt.open_loop ){
+        return;
+    }
+    long long now = now_us();
+    if( now >= w->end ){
+        return;
+    }
+    if( c->fd < 0 && !open_conn( w, c ) ){
+        w->errors++;
+        return;
+    }
+    for( int k = capacity( c ); k > 0; k-- ){
+        queue_request( w, c, now );
+    }
+    if( c->state != CONN_CONNECTING && !flush( w, c ) ){
+        close_conn( w, c, true );
+    }
+}
+
+static void complete_response( worker_ctx* w, bench_conn* c ){
+    long long now = now_us();
+    long long start = c->starts[ c->head ];
+    c->head = ( c->head + 1 ) % MAX_DEPTH;
+    c->outstanding--;
+    if( start >= w->record_from && now <= w->end ){
+        w->hist.record( now - start );
+        w->completed++;
+        if( c->status < 200 || c->status >= 300 ){
+            w->non_2xx++;
+        }
+    }
+}
+
+// 增量解析响应：先找头部结束，再按Content-Length跳过响应体
+static bool consume( worker_ctx* w, bench_conn* c, const char* data, int len ){
+    int pos = 0;
+    while( pos < len ){
+        if( c->state == CONN_DRAIN ){
+            return true;    //非keep-alive响应之后的数据不关心，等待对方关闭
+        }
+        if( c->state == CONN_HEADER ){
+            int old = c->header_len;
+            int take = len - pos;
+            if( take > HEADER_MAX - 1 - old ){
+                take = HEADER_MAX - 1 - old;
+            }
+            memcpy( c->header + old, data + pos, take );
+            c->header_len += take;
+            c->header[ c->header_len ] = '\0';
+            char* end = strstr( c->header + ( old > 3 ? old - 3 : 0 ), "\r\n\r\n" );
+            if( !end ){
+                if( c->header_len >= HEADER_MAX - 1 ){
+                    return false;
+                }
+                pos += take;
+                continue;
+            }
+            int header_size = end + 4 - c->header;
+            pos += header_size - old;
+            c->status = strncmp( c->header, "HTTP/1.", 7 ) == 0 ? atoi( c->header + 9 ) : 0;
+            char* cl = strcasestr( c->header, "\r\ncontent-length:" );
+            c->body_left = cl ? atoll( cl + 17 ) : 0;
+            c->header_len = 0;
+            c->state = CONN_BODY;
+        }
+        long long take = len - pos;
+        if( take > c->body_left ){
+            take = c->body_left;
+        }
+        c->body_left -= take;
+        pos += take;
+        if( c->body_left == 0 ){
+            if( c->outstanding == 0 ){
+                return false;   //收到了没有请求的响应
+            }
+            complete_response( w, c );
+            c->state = opt.keepalive ? CONN_HEADER : CONN_DRAIN;
+        }
+    }
+    return true;
+}
+
+static void handle_event( worker_ctx* w, bench_conn* c, unsigned events, char* buf, int buf_size ){
+    if( c->state == CONN_CONNECTING ){
+        int err = 0;
+        socklen_t len = sizeof( err );
+        getsockopt( c->fd, SOL_SOCKET, SO_ERROR, &err, &len );
+        if( err != 0 || ( events & ( EPOLLERR | EPOLLHUP ) ) ){
+            close_conn( w, c, true );
+            w->errors++;
+            refill( w, c );
+            return;
+        }
+        c->state = CONN_HEADER;
+        long long now = now_us();
+        if( c->connect_start >= w->record_from && now <= w->end ){
+            w->connect_hist.record( now - c->connect_start );
+            w->connected++;
+        }
+        if( !flush( w, c ) ){
+            close_conn( w, c, true );
+            refill( w, c );
+            return;
+        }
+        if( c->outstanding == 0 ){
+            refill( w, c );
+        }
+        return;
+    }
+    if( ( events & EPOLLOUT ) && !flush( w, c ) ){
+        close_conn( w, c, true );
+        refill( w, c );
+        return;
+    }
+    if( !( events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) ){
+        return;
+    }
+    while( true ){
+        ssize_t n = recv( c->fd, buf, buf_size, 0 );
+        if( n > 0 ){
+            long long now = now_us();
+            if( now >= w->record_from && now <= w->end ){
+                w->bytes += n;
+            }
+            if( !consume( w, c, buf, n ) ){
+                close_conn( w, c, true );
+                w->errors++;
+                break;
+            }
+            continue;
+        }
+        if( n < 0 && errno == EAGAIN ){
+            if( opt.keepalive ){
+                refill( w, c );
+            }
+            return;
+        }
+        // 对方关闭：非keep-alive模式下是正常结束，否则未完成的请求计为错误
+        close_conn( w, c, c->outstanding > 0 );
+        break;
+    }
+    refill( w, c );
+}
+
+static void* worker_main( void* arg ){
+    worker_ctx* w = ( worker_ctx* )arg;
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    static const int BUF_SIZE = 64 * 1024;
+    char* buf = new char[ BUF_SIZE ];
+
+    long long start = now_us();
+    w->record_from = start + ( long long )( opt.warmup * 1e6 );
+    w->end = w->record_from + ( long long )( opt.duration * 1e6 );
+    w->next_due_ns = start * 1000;
+    for( int i = 0; i < w->conn_count; i++ ){
+        w->conns[i].fd = -1;
+        if( !opt.open_loop ){
+            refill( w, &w->conns[i] );
+        }
+        else if( !open_conn( w, &w->conns[i] ) ){
+            w->errors++;
+        }
+    }
+
+    while( true ){
+        long long now = now_us();
+        if( now >= w->end ){
+            break;
+        }
+        int timeout = 100;
+        if( opt.open_loop ){
+            // 把到期的请求按计划时刻放入队列
+            long long now_ns = now * 1000;
+            while( w->next_due_ns <= now_ns ){
+                if( w->backlog_tail - w->backlog_head < OPEN_BACKLOG ){
+                    w->backlog[ w->backlog_tail++ % OPEN_BACKLOG ] = w->next_due_ns / 1000;
+                }
+                else{
+                    w->dropped++;
+                }
+                w->next_due_ns += w->interval_ns;
+            }
+            dispatch_backlog( w );
+            timeout = ( int )( ( w->next_due_ns - now_ns ) / 1000000 );
+        }
+        int n = epoll_wait( w->epollfd, events, MAX_EVENTS, timeout );
+        for( int i = 0; i < n; i++ ){
+            handle_event( w, ( bench_conn* )events[i].data.ptr, events[i].events, buf, BUF_SIZE );
+        }
+    }
+    // 结束时仍未完成的请求不计入结果
+    for( int i = 0; i < w->conn_count; i++ ){
+        close_conn( w, &w->conns[i], false );
+    }
+    delete [] buf;
+    return w;
+}
+
+static void usage( const char* prog ){
+    fprintf( stderr, "usage: %s [-h ip] [-p port] [-t threads] [-c connections] [-d seconds] [-w warmup_seconds]\n"
+                     "          [-m closed|open] [-r requests_per_second] [-k 0|1] [-P pipeline_depth] [-u url]...\n", prog );
+}
+
+int main( int argc, char* argv[] )
+{
+    opt.ip = "127.0.0.1";
+    opt.port = 12345;
+    opt.threads = 2;
+    opt.connections = 64;
+    opt.duration = 5;
+    opt.warmup = 1;
+    opt.open_loop = false;
+    opt.rate = 10000;
+    opt.keepalive = true;
+    opt.depth = 1;
+    opt.url_count = 0;
+
+    int c;
+    while( ( c = getopt( argc, argv, "h:p:t:c:d:w:m:r:k:P:u:" ) ) != -1 ){
+        switch( c ){
+            case 'h': opt.ip = optarg; break;
+            case 'p': opt.port = atoi( optarg ); break;
+            case 't': opt.threads = atoi( optarg ); break;
+            case 'c': opt.connections = atoi( optarg ); break;
+            case 'd': opt.duration = atof( optarg ); break;
+            case 'w': opt.warmup = atof( optarg ); break;
+            case 'm': opt.open_loop = strcmp( optarg, "open" ) == 0; break;
+            case 'r': opt.rate = atof( optarg ); break;
+            case 'k': opt.keepalive = atoi( optarg ) != 0; break;
+            case 'P': opt.depth = atoi( optarg ); break;
+            case 'u':
+                if( opt.url_count < MAX_URLS ){
+                    opt.urls[ opt.url_count++ ] = optarg;
+                }
+                break;
+            default:
+                usage( argv[0] );
+                return 1;
+        }
+    }
+    if( opt.url_count == 0 ){
+        opt.urls[ opt.url_count++ ] = "/index.html";
+    }
+    if( opt.threads <= 0 || opt.connections < opt.threads || opt.depth <= 0 || opt.depth > MAX_DEPTH
+        || opt.duration <= 0 || ( opt.open_loop && opt.rate <= 0 ) ){
+        usage( argv[0] );
+        return 1;
+    }
+    if( !opt.keepalive ){
+        opt.depth = 1;  //每个连接只发一个请求，不存在流水线
+    }
+    for( int i = 0; i < opt.url_count; i++ ){
+        request_lens[i] = snprintf( requests[i], sizeof( requests[i] ), "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\n\r\n",
+                                    opt.urls[i], opt.ip, opt.port, opt.keepalive ? "keep-alive" : "close" );
+    }
+
+    worker_ctx* workers = new worker_ctx[ opt.threads ];
+    for( int i = 0; i < opt.threads; i++ ){
+        worker_ctx* w = &workers[i];
+        memset( ( void* )w, 0, sizeof( worker_ctx ) );
+        w->hist.reset();
+        w->id = i;
+        w->epollfd = epoll_create1( 0 );
+        w->conn_count = opt.connections / opt.threads + ( i < opt.connections % opt.threads ? 1 : 0 );
+        w->conns = new bench_conn[ w->conn_count ];
+        w->next_url = i;
+        if( opt.open_loop ){
+            w->interval_ns = ( long long )( 1e9 * opt.threads / opt.rate );
+            if( w->interval_ns <= 0 ){
+                w->interval_ns = 1;
+            }
+            w->backlog = new long long[ OPEN_BACKLOG ];
+        }
+        if( pthread_create( &w->thread, NULL, worker_main, w ) != 0 ){
+            fprintf( stderr, "failed to create thread %d\n", i );
+            return 1;
+        }
+    }
+
+    histogram total;
+    histogram connect_total;
+    uint64_t connected = 0;
+    uint64_t completed = 0, errors = 0, non_2xx = 0, bytes = 0, connects = 0, dropped = 0, unsent = 0;
+    for( int i = 0; i < opt.threads; i++ ){
+        worker_ctx* w = &workers[i];
+        pthread_join( w->thread, NULL );
+        total.merge( w->hist );
+        connect_total.merge( w->connect_hist );
+        connected += w->connected;
+        completed += w->completed;
+        errors += w->errors;
+        non_2xx += w->non_2xx;
+        bytes += w->bytes;
+        connects += w->connects;
+        dropped += w->dropped;
+        unsent += w->backlog_tail - w->backlog_head;
+        close( w->epollfd );
+        delete [] w->conns;
+        delete [] w->backlog;
+    }
+    delete [] workers;
+
+    printf( "{\"mode\":\"%s\",\"keepalive\":%s,\"pipeline\":%d,\"threads\":%d,\"connections\":%d,\"duration_s\":%.3f,",
+            opt.open_loop ? "open" : "closed", opt.keepalive ? "true" : "false", opt.depth, opt.threads, opt.connections, opt.duration );
+    if( opt.open_loop ){
+        printf( "\"target_rps\":%.1f,\"unsent\":%llu,\"dropped\":%llu,", opt.rate, ( unsigned long long )unsent, ( unsigned long long )dropped );
+    }
+    printf( "\"urls\":[" );
+    for( int i = 0; i < opt.url_count; i++ ){
+        printf( "%s\"%s\"", i ? "," : "", opt.urls[i] );
+    }
+    printf( "],\"requests\":%llu,\"errors\":%llu,\"non_2xx\":%llu,\"connects\":%llu,\"rps\":%.1f,\"mbytes_per_s\":%.2f,",
+            ( unsigned long long )completed, ( unsigned long long )errors, ( unsigned long long )non_2xx, ( unsigned long long )connects,
+            completed / opt.duration, bytes / opt.duration / 1e6 );
+    printf( "\"latency_us\":{\"mean\":%.1f,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld},",
+            total.total ? total.sum / total.total : 0.0, total.percentile( 50 ), total.percentile( 90 ),
+            total.percentile( 99 ), total.percentile( 99.9 ), total.max );
+    printf( "\"connects_per_s\":%.1f,\"connect_us\":{\"p50\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld}}\n",
+            connected / opt.duration, connect_total.percentile( 50 ), connect_total.percentile( 99 ),
+            connect_total.percentile( 99.9 ), connect_total.max );
+    return 0;
+}
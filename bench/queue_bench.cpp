@@ -0,0 +1,147 @@
+/*
+线程池请求队列基准测试：比较原来的 std::list + 互斥锁 + 信号量 实现、
+无锁环形队列 + 先自旋后休眠（fifo_queue）、工作窃取（stealing_queue）
+在 1~64 个生产者/消费者线程下的吞吐量。
+用法: ./bench/queue_bench [每轮操作数]
+*/
+#include <list>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "../locker.h"
+#include "../threadpool.h"
+
+struct item {};
+static item stop_token;  //消费者收到后退出
+
+// 原threadpool中的队列实现
+class locked_queue{
+public:
+    locked_queue(int thread_number, int max_requests) : max_requests(max_requests) {}
+    bool push(item* request, unsigned key){
+        queue_locker.lock();
+        if(request_queue.size() >= (size_t)max_requests){
+            queue_locker.unlock();
+            return false;
+        }
+        request_queue.push_back(request);
+        queue_locker.unlock();
+        queue_sem.post();
+        return true;
+    }
+    item* pop(int worker){
+        queue_sem.wait();
+        queue_locker.lock();
+        if(request_queue.empty()){
+            queue_locker.unlock();
+            return NULL;
+        }
+        item* request = request_queue.front();
+        request_queue.pop_front();
+        queue_locker.unlock();
+        return request;
+    }
+private:
+    int max_requests;
+    std::list<item*> request_queue;
+    locker queue_locker;
+    sem queue_sem;
+};
+
+template<typename Q>
+struct bench_ctx{
+    Q* queue;
+    long per_producer;
+    std::atomic<int> next_id;   //生产者用作亲和key，消费者用作工作线程编号
+    std::atomic<long> consumed; //已取出的元素数，全部取完后才投递结束标记
+};
+
+template<typename Q>
+static void* producer(void* arg){
+    bench_ctx<Q>* ctx = (bench_ctx<Q>*)arg;
+    static item payload;
+    unsigned key = ctx->next_id.fetch_add(1);
+    for(long i = 0; i < ctx->per_producer; i++){
+        while(!ctx->queue->push(&payload, key + i))
+            sched_yield();  //队列满，等待消费者
+    }
+    return NULL;
+}
+
+template<typename Q>
+static void* consumer(void* arg){
+    bench_ctx<Q>* ctx = (bench_ctx<Q>*)arg;
+    int id = ctx->next_id.fetch_add(1);
+    long local = 0;
+    while(true){
+        item* request = ctx->queue->pop(id);
+        if(request == &stop_token)
+            break;
+        if(request && ++local == 64){
+            ctx->consumed.fetch_add(local, std::memory_order_relaxed);
+            local = 0;
+        }
+    }
+    ctx->consumed.fetch_add(local, std::memory_order_relaxed);
+    return NULL;
+}
+
+static double now_sec(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 返回每秒完成的入队+出队对数（百万）
+template<typename Q>
+static double run(int threads, long ops){
+    Q queue(threads, 10000);
+    bench_ctx<Q> ctx;
+    ctx.queue = &queue;
+    ctx.per_producer = ops / threads;
+    ctx.next_id.store(0);
+    pthread_t* producers = new pthread_t[threads];
+    pthread_t* consumers = new pthread_t[threads];
+
+    double start = now_sec();
+    for(int i = 0; i < threads; i++)
+        pthread_create(consumers + i, NULL, consumer<Q>, &ctx);
+    while(ctx.next_id.load() < threads)
+        sched_yield();      //消费者先拿到 0~threads-1 的编号
+    ctx.next_id.store(0);
+    for(int i = 0; i < threads; i++)
+        pthread_create(producers + i, NULL, producer<Q>, &ctx);
+    for(int i = 0; i < threads; i++)
+        pthread_join(producers[i], NULL);
+    // 消费者按64个一批汇报，剩余不足一批的部分在退出时汇报
+    long total = ctx.per_producer * threads;
+    while(ctx.consumed.load(std::memory_order_relaxed) + 64 * threads < total)
+        sched_yield();
+    for(int i = 0; i < threads; i++){
+        while(!queue.push(&stop_token, i))
+            sched_yield();
+    }
+    for(int i = 0; i < threads; i++)
+        pthread_join(consumers[i], NULL);
+    double elapsed = now_sec() - start;
+
+    delete[] producers;
+    delete[] consumers;
+    return ctx.per_producer * threads / elapsed / 1e6;
+}
+
+int main(int argc, char* argv[]){
+    long ops = argc > 1 ? atol(argv[1]) : 2000000;
+    printf("%-8s %18s %18s %18s\n", "threads", "list+mutex Mops/s", "lock-free Mops/s", "stealing Mops/s");
+    for(int threads = 1; threads <= 64; threads *= 2){
+        double locked = run<locked_queue>(threads, ops);
+        double lockfree = run< fifo_queue<item> >(threads, ops);
+        double stealing = run< stealing_queue<item> >(threads, ops);
+        printf("%-8d %18.2f %18.2f %18.2f\n", threads, locked, lockfree, stealing);
+    }
+    return 0;
+}
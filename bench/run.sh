@@ -0,0 +1,36 @@
+#!/bin/bash
+# make bench调用：启动server，依次运行各个压测场景，输出一个JSON数组
+# 用法: bench/run.sh [端口] [每个场景的秒数] [反应堆数量]
+PORT=${1:-12345}
+DURATION=${2:-5}
+REACTORS=${3:-0}
+BENCH="./bench/http_bench -p $PORT -d $DURATION -w 1"
+
+cd "$(dirname "$0")/.." || exit 1
+./server 127.0.0.1 "$PORT" "$REACTORS" > /dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2> /dev/null; wait $SERVER 2> /dev/null' EXIT
+
+# 等待监听socket就绪
+for i in $(seq 50); do
+    (exec 3<> /dev/tcp/127.0.0.1/"$PORT") 2> /dev/null && break
+    sleep 0.1
+done
+
+scenarios=(
+    "-m closed -k 1 -c 64 -u /index.html"
+    "-m closed -k 1 -c 64 -u /images/a.png"
+    "-m closed -k 1 -c 64 -P 8 -u /index.html"
+    "-m closed -k 0 -c 16 -u /index.html"
+    "-m closed -k 0 -c 512 -u /images/a.png"
+    "-m open -k 1 -c 64 -r 5000 -u /index.html -u /images/a.png"
+)
+
+echo "["
+for i in "${!scenarios[@]}"; do
+    result=$($BENCH ${scenarios[$i]})
+    [ "$i" -gt 0 ] && echo ","
+    echo -n "$result"
+done
+echo
+echo "]"
@@ -0,0 +1,54 @@
+#include "buffer_chain.h"
+
+char* buffer_chain::reserve( size_t n ){
+    if( m_tail && m_tail->capacity - m_tail->used >= n ){
+        return end();
+    }
+    size_t size = m_tail ? m_tail->size * 2 : FIRST_SLICE;
+    if( size > MAX_SLICE ){
+        size = MAX_SLICE;
+    }
+    while( size < n + sizeof( slice ) ){
+        size *= 2;
+    }
+    slice* s = ( slice* )m_pool->acquire( size );
+    if( !s ){
+        return NULL;
+    }
+    s->next = NULL;
+    s->size = size;
+    s->capacity = buffer_pool::capacity( size ) - sizeof( slice );
+    s->used = 0;
+    if( m_tail ){
+        m_tail->next = s;
+    }
+    else{
+        m_head = s;
+    }
+    m_tail = s;
+    return s->data();
+}
+
+void buffer_chain::reset(){
+    if( !m_head ){
+        return;
+    }
+    slice* s = m_head->next;
+    while( s ){
+        slice* next = s->next;
+        m_pool->release( ( char* )s, s->size );
+        s = next;
+    }
+    m_head->next = NULL;
+    m_head->used = 0;
+    m_tail = m_head;
+}
+
+void buffer_chain::release(){
+    while( m_head ){
+        slice* next = m_head->next;
+        m_pool->release( ( char* )m_head, m_head->size );
+        m_head = next;
+    }
+    m_tail = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef BUFFER_CHAIN_H
+#define BUFFER_CHAIN_H
+
+#include <stddef.h>
+
+#include "buffer_pool.h"
+
+/*
+缓冲区链：按需从缓冲区池借用的若干片缓冲区，用来存放连接的响应头（及错误页）。
+数据依次写入最后一片，剩余空间不够时借用新的一片（每片是上一片的两倍，至多MAX_SLICE），
+已写入的数据在reset/release之前地址不变，响应队列可以直接引用它们，不需要像定长缓冲区那样整体搬移。
+*/
+class buffer_chain
+{
+public:
+    static const size_t FIRST_SLICE = 1024;     //第一片的大小（含片头）
+    static const size_t MAX_SLICE = 16384;      //单片大小的上限
+
+    buffer_chain() : m_pool( NULL ), m_head( NULL ), m_tail( NULL ) {}
+
+    void init(buffer_pool* pool) {m_pool = pool;}
+    bool empty() const {return m_head == NULL;}
+    char* reserve(size_t n);    //保证最后一片至少还有n字节连续空间，返回写入位置；借不到缓冲区时返回NULL
+    char* end() const {return m_tail ? m_tail->data() + m_tail->used : NULL;}  //当前写入位置
+    size_t room() const {return m_tail ? m_tail->capacity - m_tail->used : 0;} //最后一片的剩余空间
+    void commit(size_t n) {m_tail->used += n;}  //在end()处写入了n字节
+    void reset();               //数据都已发送：保留第一片并清空，其余归还
+    void release();             //归还所有片
+
+private:
+    struct slice
+    {
+        slice* next;
+        size_t size;            //向缓冲区池借用的大小
+        size_t capacity;        //片头之后可用的字节数
+        size_t used;
+        char* data() const {return ( char* )( this + 1 );}
+    };
+
+    buffer_pool* m_pool;
+    slice* m_head;
+    slice* m_tail;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool( int max_free, bool shared )
+    : m_max_free( max_free ), m_in_use( 0 ), m_cached( 0 ), m_shared( shared )
+{
+    for( int i = 0; i < CLASS_NUMBER; i++ ){
+        m_free[i] = NULL;
+        m_free_count[i] = 0;
+    }
+}
+
+buffer_pool::~buffer_pool(){
+    for( int i = 0; i < CLASS_NUMBER; i++ ){
+        while( m_free[i] ){
+            free_block* next = m_free[i]->next;
+            free( m_free[i] );
+            m_free[i] = next;
+        }
+    }
+}
+
+int buffer_pool::size_class( size_t size ){
+    int cls = 0;
+    while( cls < CLASS_NUMBER && ( ( size_t )1 << ( MIN_SHIFT + cls ) ) < size ){
+        cls++;
+    }
+    return cls < CLASS_NUMBER ? cls : -1;
+}
+
+size_t buffer_pool::capacity( size_t size ){
+    int cls = size_class( size );
+    return cls < 0 ? size : ( size_t )1 << ( MIN_SHIFT + cls );
+}
+
+char* buffer_pool::acquire( size_t size ){
+    if( !m_shared ){
+        return take( size );
+    }
+    m_lock.lock();
+    char* buf = take( size );
+    m_lock.unlock();
+    return buf;
+}
+
+void buffer_pool::release( char* buf, size_t size ){
+    if( !buf ){
+        return;
+    }
+    if( !m_shared ){
+        give( buf, size );
+        return;
+    }
+    m_lock.lock();
+    give( buf, size );
+    m_lock.unlock();
+}
+
+char* buffer_pool::take( size_t size ){
+    int cls = size_class( size );
+    size_t cap = capacity( size );
+    char* buf = NULL;
+    if( cls >= 0 && m_free[cls] ){
+        buf = ( char* )m_free[cls];
+        m_free[cls] = m_free[cls]->next;
+        m_free_count[cls]--;
+        m_cached -= cap;
+    }
+    else{
+        buf = ( char* )malloc( cap );
+        if( !buf ){
+            return NULL;
+        }
+    }
+    m_in_use += cap;
+    return buf;
+}
+
+void buffer_pool::give( char* buf, size_t size ){
+    int cls = size_class( size );
+    size_t cap = capacity( size );
+    m_in_use -= cap;
+    if( cls < 0 || m_free_count[cls] >= m_max_free ){
+        free( buf );
+        return;
+    }
+    free_block* block = ( free_block* )buf;
+    block->next = m_free[cls];
+    m_free[cls] = block;
+    m_free_count[cls]++;
+    m_cached += cap;
+}
@@ -0,0 +1,50 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#include "locker.h"
+
+/*
+按大小分级的缓冲区池：1KB、2KB、4KB……64KB共7级，每级一个空闲链表。
+连接只在处理请求期间借用读写缓冲区，空闲的keep-alive连接不占缓冲区，
+内存随活跃连接数而不是连接总数增长。每级缓存的空闲缓冲区数有上限，超出的直接归还系统。
+通常不加锁，只由所属的反应堆线程借用和归还；单反应堆+线程池模式下工作线程生成响应时也会借用，
+此时以shared构造，借用和归还都加锁。
+*/
+class buffer_pool
+{
+public:
+    static const int MIN_SHIFT = 10;       //最小一级1KB
+    static const int CLASS_NUMBER = 7;     //最大一级64KB，更大的请求直接malloc
+
+    explicit buffer_pool(int max_free = 256, bool shared = false); //每级最多缓存max_free个空闲缓冲区
+    ~buffer_pool();
+
+    char* acquire(size_t size);             //借用容量不小于size的缓冲区，失败时返回NULL
+    void release(char* buf, size_t size);   //归还缓冲区，size与借用时相同
+    static size_t capacity(size_t size);    //size所在级别的实际容量
+
+    size_t in_use() const {return m_in_use;}   //借出中的字节数
+    size_t cached() const {return m_cached;}   //空闲链表中的字节数
+
+private:
+    static int size_class(size_t size);     //size所在的级别，超过最大一级时返回-1
+    char* take(size_t size);
+    void give(char* buf, size_t size);
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    free_block* m_free[CLASS_NUMBER];
+    int m_free_count[CLASS_NUMBER];
+    int m_max_free;
+    size_t m_in_use;
+    size_t m_cached;
+    bool m_shared;
+    locker m_lock;                          //m_shared时保护以上所有成员
+};
+
+#endif
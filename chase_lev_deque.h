@@ -0,0 +1,88 @@
+#ifndef CHASE_LEV_DEQUE_H
+#define CHASE_LEV_DEQUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mpmc_queue.h"
+
+/*
+Chase-Lev工作窃取双端队列（按Lê等人的C11内存模型版本实现，固定容量）
+只有所属线程调用push/pop，在底部(bottom)进行，不需要原子读改写；
+其他线程调用steal，在顶部(top)用CAS竞争，最后一个元素由pop和steal通过CAS决出归属。
+*/
+template<typename T, size_t Capacity = 64>
+class chase_lev_deque
+{
+public:
+    chase_lev_deque() : m_top(0), m_bottom(0) {}
+
+    bool push(const T& data);   //所属线程：放入底部，满时返回false
+    bool pop(T& data);          //所属线程：从底部取出
+    bool steal(T& data);        //其他线程：从顶部窃取
+    size_t size() const;        //近似的元素个数
+
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_top;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> m_bottom;
+    std::atomic<T> m_buffer[Capacity];
+};
+
+template<typename T, size_t Capacity>
+bool chase_lev_deque<T, Capacity>::push(const T& data)
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    if(b - t >= (int64_t)Capacity)
+        return false;
+    m_buffer[b & (Capacity - 1)].store(data, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template<typename T, size_t Capacity>
+bool chase_lev_deque<T, Capacity>::pop(T& data)
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if(t > b){
+        m_bottom.store(b + 1, std::memory_order_relaxed);   //队列为空
+        return false;
+    }
+    data = m_buffer[b & (Capacity - 1)].load(std::memory_order_relaxed);
+    if(t == b){
+        // 只剩最后一个元素，和窃取者竞争
+        bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template<typename T, size_t Capacity>
+bool chase_lev_deque<T, Capacity>::steal(T& data)
+{
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if(t >= b)
+        return false;
+    data = m_buffer[t & (Capacity - 1)].load(std::memory_order_relaxed);
+    return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template<typename T, size_t Capacity>
+size_t chase_lev_deque<T, Capacity>::size() const
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
+
+#endif
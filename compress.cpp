@@ -0,0 +1,120 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "compress.h"
+
+static const size_t LARGE_INPUT = 1 << 20;  //超过这个大小时降低压缩级别，避免后台线程长时间占用CPU
+
+int parse_accept_encoding( const char* value ){
+    int mask = 0;
+    const char* p = value;
+    while( *p ){
+        p += strspn( p, " \t," );
+        const char* name = p;
+        size_t len = strcspn( p, " \t,;" );
+        p += len;
+        // 参数中只关心q值，q=0表示明确拒绝
+        bool accepted = true;
+        while( *p && *p != ',' ){
+            if( ( *p == 'q' || *p == 'Q' ) && p[1] == '=' ){
+                accepted = strtod( p + 2, NULL ) > 0;
+                p += 2;
+                continue;
+            }
+            p++;
+        }
+        if( !accepted || len == 0 ){
+            continue;
+        }
+        if( ( len == 4 && strncasecmp( name, "gzip", 4 ) == 0 ) || ( len == 6 && strncasecmp( name, "x-gzip", 6 ) == 0 ) ){
+            mask |= 1 << ENCODING_GZIP;
+        }
+        else if( len == 2 && strncasecmp( name, "br", 2 ) == 0 ){
+            mask |= 1 << ENCODING_BR;
+        }
+        else if( len == 1 && name[0] == '*' ){
+            mask |= ( 1 << ENCODING_GZIP ) | ( 1 << ENCODING_BR );
+        }
+    }
+    return mask;
+}
+
+const char* encoding_name( CONTENT_ENCODING enc ){
+    static const char* names[ENCODING_NUMBER] = {"identity", "gzip", "br"};
+    return names[enc];
+}
+
+const char* encoding_suffix( CONTENT_ENCODING enc ){
+    static const char* suffixes[ENCODING_NUMBER] = {"", ".gz", ".br"};
+    return suffixes[enc];
+}
+
+bool compressible_type( const char* type ){
+    if( strncmp( type, "text/", 5 ) == 0 ){
+        return true;
+    }
+    // 结构化文本，以及未压缩、压缩效果好的二进制格式（wasm、ico、bmp、ttf/otf/eot字体）
+    static const char* text_types[] = {"application/json", "application/ld+json", "application/manifest+json", "application/xml",
+                                       "application/xhtml+xml", "application/rss+xml", "application/atom+xml", "image/svg+xml",
+                                       "application/javascript", "application/wasm", "image/x-icon", "image/bmp",
+                                       "application/vnd.ms-fontobject", "font/ttf", "font/otf"};
+    for( size_t i = 0; i < sizeof( text_types ) / sizeof( text_types[0] ); i++ ){
+        if( strcmp( type, text_types[i] ) == 0 ){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool gzip_compress( const char* data, size_t len, std::string& out ){
+    z_stream zs;
+    memset( &zs, 0, sizeof( zs ) );
+    // windowBits加16输出gzip格式而不是zlib格式
+    if( deflateInit2( &zs, len > LARGE_INPUT ? 6 : 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY ) != Z_OK ){
+        return false;
+    }
+    out.resize( deflateBound( &zs, len ) );
+    zs.next_in = ( Bytef* )data;
+    zs.avail_in = len;
+    zs.next_out = ( Bytef* )&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate( &zs, Z_FINISH );
+    out.resize( zs.total_out );
+    deflateEnd( &zs );
+    return ret == Z_STREAM_END;
+}
+
+static bool brotli_compress( const char* data, size_t len, std::string& out ){
+#ifdef USE_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize( len );
+    if( size == 0 ){
+        return false;
+    }
+    out.resize( size );
+    int quality = len > LARGE_INPUT ? 6 : BROTLI_MAX_QUALITY;
+    if( !BrotliEncoderCompress( quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, ( const uint8_t* )data,
+                                &size, ( uint8_t* )&out[0] ) ){
+        return false;
+    }
+    out.resize( size );
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool compress_buffer( CONTENT_ENCODING enc, const char* data, size_t len, std::string& out ){
+    switch( enc ){
+        case ENCODING_GZIP:
+            return gzip_compress( data, len, out );
+        case ENCODING_BR:
+            return brotli_compress( data, len, out );
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <string>
+
+/*
+内容编码协商和压缩
+gzip使用zlib；brotli使用libbrotlienc，编译时未开启（make BROTLI=0）时只能发送磁盘上预先压缩好的.br文件。
+*/
+
+// 响应可使用的内容编码，Accept-Encoding解析为 1 << CONTENT_ENCODING 的位集合
+enum CONTENT_ENCODING {ENCODING_IDENTITY = 0, ENCODING_GZIP, ENCODING_BR, ENCODING_NUMBER};
+
+// 解析Accept-Encoding的值，q=0的编码视为不可接受，"*"表示所有编码
+int parse_accept_encoding(const char* value);
+
+// Content-Encoding中的名字："gzip"、"br"
+const char* encoding_name(CONTENT_ENCODING enc);
+
+// 预先压缩好的同名文件的后缀：".gz"、".br"
+const char* encoding_suffix(CONTENT_ENCODING enc);
+
+// 按Content-Type判断是否是值得压缩的文本资源
+bool compressible_type(const char* type);
+
+// 把[data, data + len)压缩到out，不支持的编码或压缩失败返回false
+bool compress_buffer(CONTENT_ENCODING enc, const char* data, size_t len, std::string& out);
+
+#endif
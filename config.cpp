@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+
+#include "config.h"
+
+enum OPTION_TYPE {OPTION_INT, OPTION_AUTO_INT, OPTION_STRING};
+
+struct option_def
+{
+    const char* name;
+    OPTION_TYPE type;
+    size_t offset;
+    long min;
+    long max;
+};
+
+#define INT_OPTION( name, min, max ) {#name, OPTION_INT, offsetof( server_config, name ), min, max}
+#define AUTO_OPTION( name, min, max ) {#name, OPTION_AUTO_INT, offsetof( server_config, name ), min, max}
+#define STRING_OPTION( name ) {#name, OPTION_STRING, offsetof( server_config, name ), 0, CONFIG_STRING_LEN - 1}
+
+static const option_def options[] = {
+    STRING_OPTION( ip ),
+    INT_OPTION( port, 1, 65535 ),
+    AUTO_OPTION( reactors, 0, 1024 ),
+    AUTO_OPTION( workers, 1, 1024 ),
+    INT_OPTION( queue_depth, 1, 1 << 24 ),
+    INT_OPTION( pool_max_workers, 0, 4096 ),
+    INT_OPTION( pool_target_wait_ms, 1, 60000 ),
+    INT_OPTION( max_conn, 1, 10000000 ),
+    INT_OPTION( max_events, 1, 1 << 20 ),
+    INT_OPTION( max_request_kb, 1, 1 << 20 ),
+    INT_OPTION( buffer_cache, 0, 1 << 20 ),
+    INT_OPTION( backlog, 1, 1 << 20 ),
+    STRING_OPTION( cpus ),
+    INT_OPTION( idle_timeout_ms, 100, 86400000 ),
+    INT_OPTION( header_timeout_ms, 100, 86400000 ),
+    INT_OPTION( write_timeout_ms, 100, 86400000 ),
+    INT_OPTION( drain_timeout_ms, 0, 86400000 ),
+    INT_OPTION( accept_budget, 1, 1 << 16 ),
+    INT_OPTION( cache_mb, 1, 1 << 20 ),
+    INT_OPTION( cache_max_file_kb, 0, 1 << 22 ),
+    INT_OPTION( cache_entries, 1, 1 << 24 ),
+    INT_OPTION( cache_revalidate_ms, 0, 86400000 ),
+    INT_OPTION( io_threads, 0, 1024 ),
+    INT_OPTION( io_queue_depth, 1, 1 << 24 ),
+    INT_OPTION( io_readahead_kb, 0, 1 << 20 ),
+    INT_OPTION( uring_entries, 8, 32768 ),
+    STRING_OPTION( doc_root ),
+    STRING_OPTION( access_log ),
+    STRING_OPTION( mime_types ),
+};
+static const int OPTION_NUMBER = sizeof( options ) / sizeof( options[0] );
+
+// 位置参数依次对应的键
+static const char* positional[] = {"ip", "port", "reactors", "max_request_kb", "backlog", "cpus"};
+static const int POSITIONAL_NUMBER = sizeof( positional ) / sizeof( positional[0] );
+
+void default_config( server_config* config ){
+    memset( config, 0, sizeof( *config ) );
+    strcpy( config->ip, "0.0.0.0" );
+    config->port = DEFAULT_PORT;
+    config->reactors = 0;
+    config->workers = POOL_THREADS;
+    config->queue_depth = POOL_QUEUE_DEPTH;
+    config->pool_max_workers = POOL_MAX_WORKERS;
+    config->pool_target_wait_ms = POOL_TARGET_WAIT_MS;
+    config->max_conn = MAX_CONN;
+    config->max_events = MAX_EVENT_NUMBER;
+    config->max_request_kb = MAX_REQUEST_KB;
+    config->buffer_cache = BUFFER_CACHE;
+    config->backlog = DEFAULT_BACKLOG;
+    strcpy( config->cpus, "none" );
+    config->idle_timeout_ms = IDLE_TIMEOUT_MS;
+    config->header_timeout_ms = HEADER_TIMEOUT_MS;
+    config->write_timeout_ms = WRITE_TIMEOUT_MS;
+    config->drain_timeout_ms = DRAIN_TIMEOUT_MS;
+    config->accept_budget = ACCEPT_BUDGET;
+    config->cache_mb = CACHE_MB;
+    config->cache_max_file_kb = CACHE_MAX_FILE_KB;
+    config->cache_entries = CACHE_ENTRIES;
+    config->cache_revalidate_ms = CACHE_REVALIDATE_MS;
+    config->io_threads = IO_THREADS;
+    config->io_queue_depth = IO_QUEUE_DEPTH;
+    config->io_readahead_kb = IO_READAHEAD_KB;
+    config->uring_entries = URING_ENTRIES;
+    strcpy( config->doc_root, DOC_ROOT );
+    strcpy( config->access_log, ACCESS_LOG_FILE );
+    strcpy( config->mime_types, MIME_TYPES_FILE );
+}
+
+bool set_config( server_config* config, const char* key, const char* value ){
+    const option_def* opt = NULL;
+    for( int i = 0; i < OPTION_NUMBER; i++ ){
+        if( strcmp( options[i].name, key ) == 0 ){
+            opt = options + i;
+            break;
+        }
+    }
+    if( !opt ){
+        printf( "config: unknown option %s\n", key );
+        return false;
+    }
+    char* field = ( char* )config + opt->offset;
+    if( opt->type == OPTION_STRING ){
+        if( strlen( value ) > ( size_t )opt->max ){
+            printf( "config: %s is too long\n", key );
+            return false;
+        }
+        strcpy( field, value );
+        return true;
+    }
+    if( opt->type == OPTION_AUTO_INT && strcmp( value, "auto" ) == 0 ){
+        *( int* )field = CONFIG_AUTO;
+        return true;
+    }
+    char* end;
+    errno = 0;
+    long v = strtol( value, &end, 10 );
+    if( end == value || *end != '\0' || errno != 0 || v < opt->min || v > opt->max ){
+        printf( "config: %s must be an integer in [%ld, %ld]%s, got \"%s\"\n", key, opt->min, opt->max,
+                opt->type == OPTION_AUTO_INT ? " or auto" : "", value );
+        return false;
+    }
+    *( int* )field = ( int )v;
+    return true;
+}
+
+// 去掉首尾空白，返回新的开头
+static char* trim( char* s ){
+    while( isspace( ( unsigned char )*s ) ){
+        s++;
+    }
+    char* end = s + strlen( s );
+    while( end > s && isspace( ( unsigned char )end[-1] ) ){
+        *--end = '\0';
+    }
+    return s;
+}
+
+bool load_config( server_config* config, const char* path, bool must_exist ){
+    FILE* fp = fopen( path, "r" );
+    if( !fp ){
+        if( must_exist || errno != ENOENT ){
+            printf( "config: cannot open %s, errno is: %d\n", path, errno );
+            return false;
+        }
+        return true;
+    }
+    char line[1024];
+    int number = 0;
+    bool ok = true;
+    while( ok && fgets( line, sizeof( line ), fp ) ){
+        number++;
+        char* comment = strchr( line, '#' );
+        if( comment ){
+            *comment = '\0';
+        }
+        char* s = trim( line );
+        if( *s == '\0' ){
+            continue;
+        }
+        char* eq = strchr( s, '=' );
+        if( !eq ){
+            printf( "config: %s:%d: expected key = value\n", path, number );
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        ok = set_config( config, trim( s ), trim( eq + 1 ) );
+        if( !ok ){
+            printf( "config: in %s:%d\n", path, number );
+        }
+    }
+    fclose( fp );
+    return ok;
+}
+
+bool parse_command_line( server_config* config, int argc, char* argv[] ){
+    default_config( config );
+    // 配置文件先于其他命令行参数生效，与它在命令行中的位置无关
+    const char* path = NULL;
+    for( int i = 1; i < argc; i++ ){
+        if( strcmp( argv[i], "-c" ) == 0 ){
+            if( i + 1 >= argc ){
+                printf( "config: -c needs a file\n" );
+                return false;
+            }
+            path = argv[++i];
+        }
+    }
+    if( !load_config( config, path ? path : CONFIG_FILE, path != NULL ) ){
+        return false;
+    }
+    int next = 0;
+    for( int i = 1; i < argc; i++ ){
+        if( strcmp( argv[i], "-c" ) == 0 ){
+            i++;
+            continue;
+        }
+        if( strncmp( argv[i], "--", 2 ) == 0 ){
+            char key[64];
+            const char* eq = strchr( argv[i], '=' );
+            size_t len = eq ? ( size_t )( eq - argv[i] - 2 ) : 0;
+            if( !eq || len == 0 || len >= sizeof( key ) ){
+                printf( "config: expected --key=value, got %s\n", argv[i] );
+                return false;
+            }
+            memcpy( key, argv[i] + 2, len );
+            key[len] = '\0';
+            if( !set_config( config, key, eq + 1 ) ){
+                return false;
+            }
+            continue;
+        }
+        if( next >= POSITIONAL_NUMBER ){
+            printf( "config: unexpected argument %s\n", argv[i] );
+            return false;
+        }
+        if( !set_config( config, positional[ next++ ], argv[i] ) ){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool resolve_config( server_config* config, int allowed_cpus ){
+    if( config->port == 0 ){
+        printf( "config: port is required\n" );
+        return false;
+    }
+    struct in_addr addr;
+    if( inet_pton( AF_INET, config->ip, &addr ) != 1 ){
+        printf( "config: ip must be an IPv4 address, got \"%s\"\n", config->ip );
+        return false;
+    }
+    if( allowed_cpus < 1 ){
+        allowed_cpus = 1;
+    }
+    if( config->reactors == CONFIG_AUTO ){
+        config->reactors = allowed_cpus;
+    }
+    if( config->workers == CONFIG_AUTO ){
+        config->workers = allowed_cpus;
+    }
+    if( config->pool_max_workers == 0 ){
+        config->pool_max_workers = config->workers * 4;
+    }
+    if( config->pool_max_workers < config->workers ){
+        printf( "config: pool_max_workers must be >= workers\n" );
+        return false;
+    }
+    // 文件缓存分成16个分片，每个分片的容量是cache_mb的1/16，读入内存的文件要放得进一个分片
+    if( ( long )config->cache_max_file_kb * 16 > ( long )config->cache_mb * 1024 ){
+        printf( "config: cache_max_file_kb must be at most cache_mb * 1024 / 16\n" );
+        return false;
+    }
+    // 文件路径由根目录和URL拼成，根目录要给URL留出空间
+    size_t root_len = strlen( config->doc_root );
+    if( root_len == 0 || root_len > 100 ){
+        printf( "config: doc_root must be 1 to 100 characters\n" );
+        return false;
+    }
+    if( config->doc_root[ root_len - 1 ] == '/' ){
+        config->doc_root[ root_len - 1 ] = '\0'; //URL以/开头
+    }
+    return true;
+}
+
+void print_config( const server_config& config ){
+    printf( "config:" );
+    for( int i = 0; i < OPTION_NUMBER; i++ ){
+        const char* field = ( const char* )&config + options[i].offset;
+        if( options[i].type == OPTION_STRING ){
+            printf( " %s=%s", options[i].name, field );
+        }
+        else{
+            printf( " %s=%d", options[i].name, *( const int* )field );
+        }
+    }
+    printf( "\n" );
+}
@@ -0,0 +1,94 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+运行参数：先取下面的默认值，再读配置文件（每行`键 = 值`，#开始的部分是注释），
+最后按顺序应用命令行：位置参数`ip port reactors max_request_kb backlog cpus`（兼容原来的用法）和`--键=值`。
+配置文件由`-c 路径`指定，未指定时若存在./server.conf则读取。启动时统一校验，不合法时打印原因并退出。
+reactors和workers可以写auto，取进程允许运行的CPU数（指定了cpus时为其中的CPU数）。
+*/
+
+#define CONFIG_FILE "./server.conf"      //未用-c指定时，存在就读取
+#define CONFIG_AUTO -1                   //reactors/workers为auto时的取值，由resolve_config换成CPU数
+#define CONFIG_STRING_LEN 256
+
+// 以下为默认值
+#define DEFAULT_PORT 0                   //必须由命令行或配置文件给出
+#define MAX_CONN 100000                  //同时在线的最大连接数，连接对象按需分配，不再受fd数值的限制
+#define MAX_EVENT_NUMBER 10000           //每次epoll_wait最多返回的事件数
+#define POOL_THREADS 8                   //线程池模式的工作线程数
+#define POOL_QUEUE_DEPTH 10000           //线程池请求队列允许积压的请求数，积压满时新请求得到503
+#define POOL_MAX_WORKERS 0               //排队时间超过目标时线程池最多扩到的线程数，0表示workers的4倍，等于workers时不调整
+#define POOL_TARGET_WAIT_MS 10           //线程池排队时间的目标
+#define MAX_REQUEST_KB 64                //一个请求（请求行+头部）的最大长度，读缓冲区从1KB按需增长到这里
+#define BUFFER_CACHE 256                 //每个反应堆的缓冲区池每级最多缓存的空闲缓冲区数
+#define DEFAULT_BACKLOG 4096             //监听队列长度，内核会截断到net.core.somaxconn
+#define IDLE_TIMEOUT_MS 60000            //keep-alive连接两次请求之间允许空闲的时间
+#define HEADER_TIMEOUT_MS 15000          //从请求的第一个字节到读完整个请求允许的时间（防slowloris）
+#define WRITE_TIMEOUT_MS 30000           //发送响应时两次写入进展之间允许的时间
+#define DRAIN_TIMEOUT_MS 30000           //停止时等待进行中的请求完成的最长时间，之后关闭剩余的连接
+#define ACCEPT_BUDGET 64                 //监听socket每次可读时最多accept的连接数，用完后留到下一轮，新连接不会饿死已有连接
+#define CACHE_MB 64                      //文件缓存的内存上限（只计读入内存的小文件）
+#define CACHE_MAX_FILE_KB 4096           //超过该大小的文件不读入内存，只缓存fd，用sendfile发送
+#define CACHE_ENTRIES 1024               //文件缓存的条目数上限
+#define CACHE_REVALIDATE_MS 1000         //缓存的文件至多每隔这么久stat一次，确认是否变化
+#define IO_THREADS 4                     //加载冷文件的I/O线程数，0表示在处理请求的线程中就地加载（io_uring引擎总是就地加载）
+#define IO_QUEUE_DEPTH 1024              //等待I/O线程的请求数上限，满了就地加载
+#define IO_READAHEAD_KB 256              //I/O线程为大文件（sendfile发送）预读的长度
+#define URING_ENTRIES 4096               //io_uring提交队列长度，完成队列是它的两倍
+#define DOC_ROOT "./www/"                //网站根目录
+#define ACCESS_LOG_FILE ""               //访问日志路径，默认不记录；开启后超过64MB时轮转，保留4个旧文件
+#define MIME_TYPES_FILE "./mime.types"   //可选，补充或覆盖内置的扩展名到Content-Type的映射
+
+struct server_config
+{
+    char ip[CONFIG_STRING_LEN];         //监听地址，0.0.0.0表示所有网卡
+    int port;
+    int reactors;                       //0表示单反应堆+线程池，N表示N个各自独立处理连接的反应堆
+    int workers;                        //线程池的工作线程数
+    int queue_depth;
+    int pool_max_workers;
+    int pool_target_wait_ms;
+    int max_conn;
+    int max_events;
+    int max_request_kb;
+    int buffer_cache;
+    int backlog;
+    char cpus[CONFIG_STRING_LEN];       //none、auto或CPU列表，见topology.h
+    int idle_timeout_ms;
+    int header_timeout_ms;
+    int write_timeout_ms;
+    int drain_timeout_ms;
+    int accept_budget;
+    int cache_mb;
+    int cache_max_file_kb;
+    int cache_entries;
+    int cache_revalidate_ms;
+    int io_threads;
+    int io_queue_depth;
+    int io_readahead_kb;
+    int uring_entries;
+    char doc_root[CONFIG_STRING_LEN];
+    char access_log[CONFIG_STRING_LEN];
+    char mime_types[CONFIG_STRING_LEN];
+};
+
+// 填入默认值
+void default_config(server_config* config);
+
+// 设置一项，键不存在或值不合法时打印原因并返回false
+bool set_config(server_config* config, const char* key, const char* value);
+
+// 读配置文件，must_exist为false时文件不存在不算错误
+bool load_config(server_config* config, const char* path, bool must_exist);
+
+// 按上面的顺序处理默认值、配置文件和命令行，出错时已打印原因
+bool parse_command_line(server_config* config, int argc, char* argv[]);
+
+// 把auto换成allowed_cpus并做各项之间的检查（如port必须给出），出错时已打印原因
+bool resolve_config(server_config* config, int allowed_cpus);
+
+// 打印生效的配置
+void print_config(const server_config& config);
+
+#endif
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+
+#include "file_cache.h"
+#include "mime.h"
+#include "metrics.h"
+
+// FNV-1a字符串哈希
+static unsigned hash_path( const char* path ){
+    unsigned h = 2166136261u;
+    for( ; *path; ++path ){
+        h ^= ( unsigned char )*path;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 条目占用的缓存字节数：小文件按文件大小计，大文件只占一个fd；压缩版本计入原文件条目
+static size_t entry_bytes( const file_entry* entry ){
+    size_t bytes = entry->data ? entry->st.st_size : 0;
+    for( int i = ENCODING_IDENTITY + 1; i < ENCODING_NUMBER; i++ ){
+        if( entry->variants[i] ){
+            bytes += entry_bytes( entry->variants[i] );
+        }
+    }
+    return bytes;
+}
+
+static void destroy( file_entry* entry ){
+    for( int i = ENCODING_IDENTITY + 1; i < ENCODING_NUMBER; i++ ){
+        if( entry->variants[i] ){
+            file_cache::release( entry->variants[i] );
+        }
+    }
+    if( entry->fd != -1 ){
+        close( entry->fd );
+    }
+    free( entry->data );
+    free( entry->path );
+    delete entry;
+}
+
+// 生成响应头，st_size是实际发送的字节数；vary为真时（文本资源及其压缩版本）让中间缓存按Accept-Encoding区分
+static void build_header( file_entry* entry, CONTENT_ENCODING enc, bool vary ){
+    const struct stat& st = entry->st;
+    // 不同编码的内容不同，强校验器也要不同
+    snprintf( entry->etag, sizeof( entry->etag ), "\"%llx-%llx%s%s\"", ( long long )st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec,
+              ( long long )st.st_size, enc != ENCODING_IDENTITY ? "-" : "", enc != ENCODING_IDENTITY ? encoding_name( enc ) : "" );
+    char modified[64];
+    struct tm tm;
+    gmtime_r( &st.st_mtime, &tm );
+    strftime( modified, sizeof( modified ), "%a, %d %b %Y %H:%M:%S GMT", &tm );
+
+    int len = snprintf( entry->header, sizeof( entry->header ), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nContent-Type:%s\r\n",
+                        ( long long )st.st_size, entry->content_type );
+    entry->fields_start = len;
+    if( enc != ENCODING_IDENTITY ){
+        len += snprintf( entry->header + len, sizeof( entry->header ) - len, "Content-Encoding: %s\r\n", encoding_name( enc ) );
+    }
+    if( vary ){
+        len += snprintf( entry->header + len, sizeof( entry->header ) - len, "Vary: Accept-Encoding\r\n" );
+    }
+    len += snprintf( entry->header + len, sizeof( entry->header ) - len, "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n",
+                     entry->etag, modified );
+    entry->header_len = len;
+}
+
+// 新建一个条目，refs为初始引用数，内容由调用者填充
+static file_entry* new_entry( const char* path, unsigned hash, const struct stat& st, int refs ){
+    file_entry* e = new file_entry;
+    e->refs.store( refs, std::memory_order_relaxed );
+    e->checked.store( metrics::now_ms(), std::memory_order_relaxed );
+    e->revalidating.store( false, std::memory_order_relaxed );
+    e->path = strdup( path );
+    e->hash = hash;
+    e->st = st;
+    e->data = NULL;
+    e->fd = -1;
+    e->cached = false;
+    e->content_type = MIME_DEFAULT_TYPE;
+    e->compressible = false;
+    memset( e->variants, 0, sizeof( e->variants ) );
+    memset( e->variant_state, 0, sizeof( e->variant_state ) );
+    e->hash_next = e->lru_prev = e->lru_next = NULL;
+    return e;
+}
+
+file_cache::file_cache( size_t capacity, size_t max_entry_size, int max_entries, int revalidate_ms )
+    : m_max_entry_size( max_entry_size ), m_revalidate_ms( revalidate_ms ),
+      m_hits( 0 ), m_misses( 0 ), m_evictions( 0 ), m_compressions( 0 ), m_stop( false )
+{
+    if( capacity == 0 || max_entries <= 0 || revalidate_ms < 0 ){
+        throw std::exception();
+    }
+    m_shard_capacity = capacity / SHARD_NUMBER;
+    m_shard_max_entries = ( max_entries + SHARD_NUMBER - 1 ) / SHARD_NUMBER;
+    m_shards = new shard[ SHARD_NUMBER ];
+    for( int i = 0; i < SHARD_NUMBER; i++ ){
+        shard& s = m_shards[i];
+        memset( s.buckets, 0, sizeof( s.buckets ) );
+        s.lru.lru_prev = s.lru.lru_next = &s.lru;
+        s.bytes = 0;
+        s.count = 0;
+    }
+    if( pthread_create( &m_compressor, NULL, compress_worker, this ) != 0 ){
+        delete [] m_shards;
+        throw std::exception();
+    }
+}
+
+file_cache::~file_cache(){
+    m_jobs_lock.lock();
+    m_stop = true;
+    m_jobs_lock.unlock();
+    m_jobs_stat.post();
+    pthread_join( m_compressor, NULL );
+    // 没来得及执行的任务放弃对原文件的引用
+    for( size_t i = 0; i < m_jobs.size(); i++ ){
+        release( m_jobs[i].source );
+    }
+    for( int i = 0; i < SHARD_NUMBER; i++ ){
+        shard& s = m_shards[i];
+        while( s.lru.lru_prev != &s.lru ){
+            erase( s, s.lru.lru_prev );
+        }
+    }
+    delete [] m_shards;
+}
+
+void file_cache::release( file_entry* entry ){
+    if( entry->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ){
+        destroy( entry );
+    }
+}
+
+file_entry* file_cache::find( shard& s, const char* path, unsigned hash ){
+    s.lock.lock();
+    file_entry* e = s.buckets[ ( hash / SHARD_NUMBER ) % BUCKET_NUMBER ];
+    while( e && ( e->hash != hash || strcmp( e->path, path ) != 0 ) ){
+        e = e->hash_next;
+    }
+    if( e ){
+        e->refs.fetch_add( 1, std::memory_order_relaxed );
+        // 移到LRU头部
+        e->lru_prev->lru_next = e->lru_next;
+        e->lru_next->lru_prev = e->lru_prev;
+        e->lru_next = s.lru.lru_next;
+        e->lru_prev = &s.lru;
+        s.lru.lru_next->lru_prev = e;
+        s.lru.lru_next = e;
+    }
+    s.lock.unlock();
+    return e;
+}
+
+file_cache::STATUS file_cache::acquire( const char* path, file_entry** entry, int encodings ){
+    unsigned hash = hash_path( path );
+    shard& s = m_shards[ hash % SHARD_NUMBER ];
+
+    file_entry* e = find( s, path, hash );
+    if( e ){
+        long now = metrics::now_ms();
+        bool fresh = now - e->checked.load( std::memory_order_relaxed ) < m_revalidate_ms || !stale( e, now );
+        if( e->revalidating.load( std::memory_order_relaxed ) ){
+            e->revalidating.store( false, std::memory_order_relaxed );
+        }
+        if( fresh ){
+            m_hits.fetch_add( 1, std::memory_order_relaxed );
+            *entry = ( encodings && e->compressible ) ? negotiate( e, encodings ) : e;
+            return FILE_OK;
+        }
+        // 文件已变化，淘汰旧条目后按未命中处理
+        s.lock.lock();
+        if( e->cached ){
+            erase( s, e );
+        }
+        s.lock.unlock();
+        release( e );
+    }
+
+    m_misses.fetch_add( 1, std::memory_order_relaxed );
+    STATUS ret = load( path, hash, &e );
+    if( ret != FILE_OK ){
+        return ret;
+    }
+    s.lock.lock();
+    insert( s, e );
+    s.lock.unlock();
+    *entry = ( encodings && e->compressible ) ? negotiate( e, encodings ) : e;
+    return FILE_OK;
+}
+
+file_cache::STATUS file_cache::try_acquire( const char* path, file_entry** entry, int encodings ){
+    unsigned hash = hash_path( path );
+    file_entry* e = find( m_shards[ hash % SHARD_NUMBER ], path, hash );
+    if( !e ){
+        return FILE_WOULD_BLOCK;
+    }
+    // 到了重新stat的时间：第一个请求交给I/O线程确认，确认之前的其他请求仍使用缓存的条目
+    if( metrics::now_ms() - e->checked.load( std::memory_order_relaxed ) >= m_revalidate_ms
+        && !e->revalidating.exchange( true, std::memory_order_relaxed ) ){
+        release( e );
+        return FILE_WOULD_BLOCK;
+    }
+    file_entry* chosen = e;
+    if( encodings && e->compressible ){
+        chosen = negotiate( e, encodings, false );
+        if( !chosen ){
+            release( e );
+            return FILE_WOULD_BLOCK;
+        }
+    }
+    m_hits.fetch_add( 1, std::memory_order_relaxed );
+    *entry = chosen;
+    return FILE_OK;
+}
+
+file_entry* file_cache::negotiate( file_entry* entry, int encodings, bool may_block ){
+    // brotli通常比gzip更小，两者都接受时优先brotli
+    static const CONTENT_ENCODING preference[] = {ENCODING_BR, ENCODING_GZIP};
+    shard& s = m_shards[ entry->hash % SHARD_NUMBER ];
+    for( size_t i = 0; i < sizeof( preference ) / sizeof( preference[0] ); i++ ){
+        CONTENT_ENCODING enc = preference[i];
+        if( !( encodings & ( 1 << enc ) ) ){
+            continue;
+        }
+        s.lock.lock();
+        file_entry* variant = entry->variants[enc];
+        if( variant ){
+            variant->refs.fetch_add( 1, std::memory_order_relaxed );
+        }
+        bool first = entry->variant_state[enc] == VARIANT_UNKNOWN;
+        if( first && !may_block ){
+            // 要先找磁盘上预先压缩好的文件
+            s.lock.unlock();
+            return NULL;
+        }
+        if( first ){
+            entry->variant_state[enc] = VARIANT_PENDING;
+        }
+        s.lock.unlock();
+
+        if( !variant && first ){
+            variant = prepare( entry, enc );
+        }
+        if( variant ){
+            release( entry );
+            return variant;
+        }
+    }
+    return entry;
+}
+
+file_entry* file_cache::prepare( file_entry* entry, CONTENT_ENCODING enc ){
+    // 优先使用预先压缩好的文件，比原文件旧的可能已经过时
+    std::string sibling( entry->path );
+    sibling += encoding_suffix( enc );
+    file_entry* variant = NULL;
+    if( load( sibling.c_str(), entry->hash, &variant ) == FILE_OK ){
+        const struct timespec& a = variant->st.st_mtim;
+        const struct timespec& b = entry->st.st_mtim;
+        if( a.tv_sec > b.tv_sec || ( a.tv_sec == b.tv_sec && a.tv_nsec >= b.tv_nsec ) ){
+            variant->content_type = entry->content_type;    //按原文件的类型，而不是.gz/.br
+            build_header( variant, enc, true );
+            attach( entry, enc, variant );
+            return variant;
+        }
+        destroy( variant );
+    }
+
+    // 内存中的文本文件交给后台线程压缩，这次先发原文件
+    shard& s = m_shards[ entry->hash % SHARD_NUMBER ];
+    if( entry->data && entry->st.st_size >= MIN_COMPRESS_SIZE ){
+        m_jobs_lock.lock();
+        bool queued = !m_stop && m_jobs.size() < MAX_COMPRESS_JOBS;
+        if( queued ){
+            entry->refs.fetch_add( 1, std::memory_order_relaxed );
+            compress_job job = {entry, enc};
+            m_jobs.push_back( job );
+        }
+        m_jobs_lock.unlock();
+        if( queued ){
+            m_jobs_stat.post();
+            return NULL;
+        }
+        // 队列已满，之后的请求再试
+        s.lock.lock();
+        entry->variant_state[enc] = VARIANT_UNKNOWN;
+        s.lock.unlock();
+        return NULL;
+    }
+    s.lock.lock();
+    entry->variant_state[enc] = VARIANT_NONE;
+    s.lock.unlock();
+    return NULL;
+}
+
+void file_cache::attach( file_entry* entry, CONTENT_ENCODING enc, file_entry* variant ){
+    shard& s = m_shards[ entry->hash % SHARD_NUMBER ];
+    s.lock.lock();
+    // 原文件条目已被淘汰或替换时丢弃压缩版本
+    if( entry->cached && !entry->variants[enc] ){
+        entry->variants[enc] = variant;
+        entry->variant_state[enc] = VARIANT_READY;
+        s.bytes += entry_bytes( variant );
+        evict( s, entry );
+        variant = NULL;
+    }
+    s.lock.unlock();
+    if( variant ){
+        release( variant );
+    }
+}
+
+void file_cache::compress( const compress_job& job ){
+    file_entry* source = job.source;
+    std::string out;
+    file_entry* variant = NULL;
+    // 压缩后没有变小就不值得发送
+    if( compress_buffer( job.enc, source->data, source->st.st_size, out ) && out.size() < ( size_t )source->st.st_size ){
+        struct stat st = source->st;
+        st.st_size = out.size();
+        variant = new_entry( source->path, source->hash, st, 1 ); // 由原文件条目持有
+        variant->data = ( char* )malloc( out.size() );
+        if( variant->data ){
+            memcpy( variant->data, out.data(), out.size() );
+            variant->content_type = source->content_type;
+            build_header( variant, job.enc, true );
+            m_compressions.fetch_add( 1, std::memory_order_relaxed );
+        }
+        else{
+            destroy( variant );
+            variant = NULL;
+        }
+    }
+    if( variant ){
+        attach( source, job.enc, variant );
+    }
+    else{
+        shard& s = m_shards[ source->hash % SHARD_NUMBER ];
+        s.lock.lock();
+        source->variant_state[job.enc] = VARIANT_NONE;
+        s.lock.unlock();
+    }
+    release( source );
+}
+
+void* file_cache::compress_worker( void* arg ){
+    file_cache* cache = ( file_cache* )arg;
+    while( true ){
+        cache->m_jobs_stat.wait();
+        cache->m_jobs_lock.lock();
+        if( cache->m_stop ){
+            cache->m_jobs_lock.unlock();
+            break;
+        }
+        if( cache->m_jobs.empty() ){
+            cache->m_jobs_lock.unlock();
+            continue;
+        }
+        compress_job job = cache->m_jobs.front();
+        cache->m_jobs.pop_front();
+        cache->m_jobs_lock.unlock();
+        cache->compress( job );
+    }
+    return NULL;
+}
+
+bool file_cache::stale( file_entry* entry, long now ){
+    struct stat st;
+    if( stat( entry->path, &st ) < 0 ){
+        return true;
+    }
+    if( st.st_mtim.tv_sec != entry->st.st_mtim.tv_sec || st.st_mtim.tv_nsec != entry->st.st_mtim.tv_nsec
+        || st.st_size != entry->st.st_size || st.st_ino != entry->st.st_ino || st.st_mode != entry->st.st_mode ){
+        return true;
+    }
+    entry->checked.store( now, std::memory_order_relaxed );
+    return false;
+}
+
+file_cache::STATUS file_cache::load( const char* path, unsigned hash, file_entry** entry ){
+    struct stat st;
+    // 没有想要的文件
+    if( stat( path, &st ) < 0 ){
+        return FILE_NOT_FOUND;
+    }
+    // 没有权限读取
+    if( !( st.st_mode & S_IROTH ) ){
+        return FILE_FORBIDDEN;
+    }
+    // 请求的资源文件是目录文件
+    if( S_ISDIR( st.st_mode ) ){
+        return FILE_IS_DIR;
+    }
+    int fd = open( path, O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ){
+        return FILE_FORBIDDEN;
+    }
+
+    file_entry* e = new_entry( path, hash, st, 2 ); // 缓存和调用者各持有一个
+    e->fd = fd;
+    e->content_type = mime_type( path );
+    e->compressible = compressible_type( e->content_type );
+
+    if( ( size_t )st.st_size <= m_max_entry_size ){
+        // 小文件一次性读入内存，之后的请求不再访问磁盘
+        e->data = ( char* )malloc( st.st_size > 0 ? st.st_size : 1 );
+        off_t done = 0;
+        while( e->data && done < st.st_size ){
+            ssize_t n = pread( fd, e->data + done, st.st_size - done, done );
+            if( n < 0 && errno == EINTR ){
+                continue;
+            }
+            if( n <= 0 ){
+                break;
+            }
+            done += n;
+        }
+        if( !e->data || done != st.st_size ){
+            destroy( e );
+            return FILE_ERROR;
+        }
+        close( fd );
+        e->fd = -1;
+    }
+
+    build_header( e, ENCODING_IDENTITY, e->compressible );
+    *entry = e;
+    return FILE_OK;
+}
+
+void file_cache::insert( shard& s, file_entry* entry ){
+    file_entry** slot = &s.buckets[ ( entry->hash / SHARD_NUMBER ) % BUCKET_NUMBER ];
+    // 并发未命中时可能已有其他线程插入了同一路径，用新加载的条目替换
+    for( file_entry* e = *slot; e; e = e->hash_next ){
+        if( e->hash == entry->hash && strcmp( e->path, entry->path ) == 0 ){
+            erase( s, e );
+            break;
+        }
+    }
+    entry->hash_next = *slot;
+    *slot = entry;
+    entry->lru_next = s.lru.lru_next;
+    entry->lru_prev = &s.lru;
+    s.lru.lru_next->lru_prev = entry;
+    s.lru.lru_next = entry;
+    entry->cached = true;
+    s.bytes += entry_bytes( entry );
+    s.count++;
+    // 刚插入的条目不淘汰
+    evict( s, entry );
+}
+
+void file_cache::evict( shard& s, file_entry* keep ){
+    while( ( s.bytes > m_shard_capacity || s.count > m_shard_max_entries ) && s.lru.lru_prev != keep ){
+        erase( s, s.lru.lru_prev );
+        m_evictions.fetch_add( 1, std::memory_order_relaxed );
+    }
+}
+
+void file_cache::erase( shard& s, file_entry* entry ){
+    file_entry** slot = &s.buckets[ ( entry->hash / SHARD_NUMBER ) % BUCKET_NUMBER ];
+    while( *slot != entry ){
+        slot = &( *slot )->hash_next;
+    }
+    *slot = entry->hash_next;
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+    entry->cached = false;
+    s.bytes -= entry_bytes( entry );
+    s.count--;
+    release( entry );
+}
@@ -0,0 +1,133 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <deque>
+
+#include "locker.h"
+#include "compress.h"
+
+/*
+缓存中的一个文件：
+小文件整个读入内存（data非空），用writev和响应头一起发送；
+大文件只保持fd打开（data为空），用sendfile按偏移发送，多个连接可共享同一个fd。
+条目带引用计数，被淘汰后仍在发送中的连接持有的引用保证数据有效，最后一个引用释放时才真正销毁。
+文本资源的压缩版本也是file_entry，挂在原文件条目的variants上，随原文件条目一起淘汰和销毁。
+*/
+struct file_entry
+{
+    std::atomic<int> refs;      //引用计数，缓存本身持有一个
+    std::atomic<long> checked;  //上一次确认文件未变化的时间(ms)
+    std::atomic<bool> revalidating; //已有一个请求交给I/O线程去重新stat，其余请求照常使用本条目
+    char* path;                 //缓存键：文件的完整路径
+    unsigned hash;
+    struct stat st;             //文件的stat信息
+    char* data;                 //文件内容，大文件为NULL
+    int fd;                     //大文件保持打开的fd，小文件为-1
+    char header[384];           //预先生成的200响应头：状态行、Content-Length、Content-Type，其后是fields_start开始的其余字段
+    int header_len;
+    int fields_start;           //header中Content-Type之后的字段：Content-Encoding、Vary、ETag、Last-Modified、Accept-Ranges，304/206响应复用
+    const char* content_type;   //按扩展名确定的类型，压缩版本沿用原文件的类型
+    char etag[48];              //强校验器，由mtime、大小和编码生成，带引号
+    bool cached;                //是否仍在缓存中（未被淘汰或替换）
+    bool compressible;          //文本资源，按Accept-Encoding协商压缩版本
+    file_entry* variants[ENCODING_NUMBER];          //各编码的压缩版本，[ENCODING_IDENTITY]不用，由分片锁保护
+    unsigned char variant_state[ENCODING_NUMBER];   //各编码压缩版本的状态，VARIANT_STATE
+
+    file_entry* hash_next;      //哈希桶链表
+    file_entry* lru_prev;       //LRU双向链表
+    file_entry* lru_next;
+};
+
+/*
+按路径索引的共享文件缓存，按哈希分片加锁以减少工作线程间的竞争。
+命中时不做任何系统调用；每个条目至多每revalidate_ms毫秒stat一次，mtime/大小/inode变化则重新加载。
+超过容量（内存字节数或条目数）时按LRU淘汰。
+压缩协商：第一次请求某个编码时先找磁盘上预先压缩好的path.br/path.gz（不比原文件旧才用）；
+没有的话把内存中的文本文件交给后台压缩线程，这次先发原文件，压缩好后挂到条目上供之后的请求使用。
+每个(路径, mtime, 编码)只压缩一次，原文件变化时连同压缩版本一起重新加载。
+*/
+class file_cache
+{
+public:
+    enum STATUS {FILE_OK = 0, FILE_NOT_FOUND, FILE_FORBIDDEN, FILE_IS_DIR, FILE_ERROR, FILE_WOULD_BLOCK};
+
+    file_cache(size_t capacity = 64 << 20, size_t max_entry_size = 4 << 20,
+               int max_entries = 1024, int revalidate_ms = 1000);
+    ~file_cache();
+
+    // 获取文件，成功时entry持有一个引用；encodings是客户端接受的编码位集合，有合适的压缩版本时返回压缩版本
+    STATUS acquire(const char* path, file_entry** entry, int encodings = 0);
+    // 不访问磁盘的acquire：未命中、到了重新stat的时间或第一次协商某个编码时返回FILE_WOULD_BLOCK，
+    // 由调用者交给I/O线程调用acquire；到了重新stat的时间时只有一个请求返回FILE_WOULD_BLOCK
+    STATUS try_acquire(const char* path, file_entry** entry, int encodings = 0);
+    static void release(file_entry* entry);               //归还acquire得到的引用
+
+    unsigned long hits() const { return m_hits.load(std::memory_order_relaxed); }
+    unsigned long misses() const { return m_misses.load(std::memory_order_relaxed); }
+    unsigned long evictions() const { return m_evictions.load(std::memory_order_relaxed); }
+    unsigned long compressions() const { return m_compressions.load(std::memory_order_relaxed); }
+
+private:
+    static const int SHARD_NUMBER = 16;   //分片数
+    static const int BUCKET_NUMBER = 256; //每个分片的哈希桶数
+    static const int MIN_COMPRESS_SIZE = 256;   //小于该大小的文件不压缩
+    static const size_t MAX_COMPRESS_JOBS = 1024; //后台压缩队列的长度上限
+
+    // 压缩版本的状态
+    enum VARIANT_STATE {VARIANT_UNKNOWN = 0, VARIANT_PENDING, VARIANT_NONE, VARIANT_READY};
+
+    struct shard
+    {
+        locker lock;
+        file_entry* buckets[BUCKET_NUMBER];
+        file_entry lru;                   //LRU哨兵，lru.lru_next为最近使用
+        size_t bytes;                     //本分片缓存的文件字节数
+        int count;                        //本分片的条目数
+    };
+
+    // 后台压缩任务，持有原文件条目的一个引用
+    struct compress_job
+    {
+        file_entry* source;
+        CONTENT_ENCODING enc;
+    };
+
+    file_entry* find(shard& s, const char* path, unsigned hash);     //查找并移到LRU头部，找到时持有一个引用
+    STATUS load(const char* path, unsigned hash, file_entry** entry); //从磁盘加载一个新条目
+    void insert(shard& s, file_entry* entry);   //加入缓存，必要时淘汰，调用者持有分片锁
+    void erase(shard& s, file_entry* entry);    //移出缓存并放弃缓存的引用，调用者持有分片锁
+    void evict(shard& s, file_entry* keep);     //超出容量时从LRU尾部淘汰，keep除外，调用者持有分片锁
+    bool stale(file_entry* entry, long now);    //重新stat判断文件是否已变化
+
+    //挑选压缩版本，返回的条目持有一个引用；may_block为false时需要访问磁盘则返回NULL，entry的引用不变
+    file_entry* negotiate(file_entry* entry, int encodings, bool may_block = true);
+    file_entry* prepare(file_entry* entry, CONTENT_ENCODING enc);   //第一次请求某个编码时查找预压缩文件或提交压缩任务
+    void attach(file_entry* entry, CONTENT_ENCODING enc, file_entry* variant); //把压缩版本挂到原文件条目上
+    void compress(const compress_job& job);     //在后台线程中执行一个压缩任务
+    static void* compress_worker(void* arg);
+
+private:
+    shard* m_shards;
+    size_t m_shard_capacity;      //每个分片的字节上限
+    size_t m_max_entry_size;      //超过该大小的文件不读入内存，只缓存fd
+    int m_shard_max_entries;      //每个分片的条目上限
+    int m_revalidate_ms;
+
+    std::atomic<unsigned long> m_hits;
+    std::atomic<unsigned long> m_misses;
+    std::atomic<unsigned long> m_evictions;
+    std::atomic<unsigned long> m_compressions;
+
+    std::deque<compress_job> m_jobs;    //等待后台压缩的任务
+    locker m_jobs_lock;
+    sem m_jobs_stat;                    //是否有任务需要处理
+    bool m_stop;
+    pthread_t m_compressor;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include "handoff.h"
+
+extern char** environ;
+
+static const char READY_BYTE = 'R';
+
+union fd_control
+{
+    struct cmsghdr align;
+    char buf[ CMSG_SPACE( sizeof( int ) * HANDOFF_MAX_FDS ) ];
+};
+
+static bool send_fds( int channel, const int* fds, int count ){
+    fd_control control;
+    memset( &control, 0, sizeof( control ) );
+    struct iovec iov;
+    iov.iov_base = &count;  //至少要带一个字节的数据，顺便告诉对方个数
+    iov.iov_len = sizeof( count );
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE( sizeof( int ) * count );
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * count );
+    memcpy( CMSG_DATA( cmsg ), fds, sizeof( int ) * count );
+    return sendmsg( channel, &msg, MSG_NOSIGNAL ) == ( ssize_t )sizeof( count );
+}
+
+static bool wait_ready( int channel ){
+    struct pollfd pfd;
+    pfd.fd = channel;
+    pfd.events = POLLIN;
+    if( poll( &pfd, 1, HANDOFF_TIMEOUT_MS ) != 1 ){
+        return false;
+    }
+    // 新进程启动失败退出时读到EOF
+    char c = 0;
+    return read( channel, &c, 1 ) == 1 && c == READY_BYTE;
+}
+
+bool handoff_start( char* const argv[], const int* listenfds, int count ){
+    if( count <= 0 || count > HANDOFF_MAX_FDS ){
+        return false;
+    }
+    int sv[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv ) < 0 ){
+        printf( "handoff: socketpair failed, errno is: %d\n", errno );
+        return false;
+    }
+    // 多线程进程fork后子进程只能调用async-signal-safe的函数，环境变量在fork之前准备好
+    char channel_env[64];
+    snprintf( channel_env, sizeof( channel_env ), "%s=%d", HANDOFF_ENV, sv[1] );
+    std::vector< char* > envp;
+    size_t prefix = strlen( HANDOFF_ENV ) + 1;
+    for( char** e = environ; *e; e++ ){
+        if( strncmp( *e, channel_env, prefix ) != 0 ){
+            envp.push_back( *e );
+        }
+    }
+    envp.push_back( channel_env );
+    envp.push_back( NULL );
+    sigset_t none;
+    sigemptyset( &none );
+
+    pid_t pid = fork();
+    if( pid < 0 ){
+        printf( "handoff: fork failed, errno is: %d\n", errno );
+        close( sv[0] );
+        close( sv[1] );
+        return false;
+    }
+    if( pid == 0 ){
+        // 信号掩码会被exec继承，main屏蔽了SIGTERM等信号，恢复后再exec
+        pthread_sigmask( SIG_SETMASK, &none, NULL );
+        fcntl( sv[1], F_SETFD, 0 );
+        execve( argv[0], argv, &envp[0] );
+        _exit( 127 );
+    }
+    close( sv[1] );
+    bool ok = send_fds( sv[0], listenfds, count ) && wait_ready( sv[0] );
+    close( sv[0] );
+    if( !ok ){
+        printf( "handoff: new process %d did not become ready\n", ( int )pid );
+        kill( pid, SIGKILL );
+        waitpid( pid, NULL, 0 );
+        return false;
+    }
+    printf( "handoff: listening sockets passed to new process %d\n", ( int )pid );
+    return true;
+}
+
+int handoff_receive( int* listenfds, int max, int* channel ){
+    *channel = -1;
+    const char* env = getenv( HANDOFF_ENV );
+    if( !env ){
+        return 0;
+    }
+    int fd = atoi( env );
+    unsetenv( HANDOFF_ENV ); //再次升级时由本进程重新设置
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    int count = 0;
+    fd_control control;
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof( count );
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof( control.buf );
+    if( recvmsg( fd, &msg, MSG_CMSG_CLOEXEC ) <= 0 ){
+        close( fd );
+        return 0;
+    }
+    int received = 0;
+    for( struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) ){
+        if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ){
+            continue;
+        }
+        int n = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+        const unsigned char* data = CMSG_DATA( cmsg );
+        for( int i = 0; i < n; i++ ){
+            int lfd;
+            memcpy( &lfd, data + i * sizeof( int ), sizeof( int ) );
+            if( received < max ){
+                listenfds[ received++ ] = lfd;
+            }
+            else{
+                close( lfd ); //新进程的反应堆比旧进程少
+            }
+        }
+    }
+    *channel = fd;
+    return received;
+}
+
+void handoff_ready( int channel ){
+    if( channel < 0 ){
+        return;
+    }
+    ssize_t n = write( channel, &READY_BYTE, 1 );
+    ( void )n;
+    close( channel );
+}
@@ -0,0 +1,24 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+/*
+不停机升级：收到SIGUSR2的旧进程fork并exec磁盘上的新server（参数不变），
+通过一对Unix socket用SCM_RIGHTS把监听socket交给新进程；新进程启动好反应堆后回复一个字节，
+旧进程收到后停止accept并排空已有连接再退出。监听socket始终有进程持有，升级期间不会拒绝连接。
+*/
+
+#define HANDOFF_ENV "HTTP_SERVER_HANDOFF_FD"    //新进程从这个环境变量得知与旧进程通信的socket
+#define HANDOFF_MAX_FDS 256                     //一次最多交接的监听socket数
+#define HANDOFF_TIMEOUT_MS 10000                //等待新进程就绪的时间，超时后旧进程继续服务
+
+// 旧进程：启动新进程并交出监听socket，新进程就绪时返回true；失败时新进程已被回收，旧进程照常运行
+bool handoff_start(char* const argv[], const int* listenfds, int count);
+
+// 新进程：由旧进程启动时取得交接过来的监听socket，最多max个（多余的关闭），返回个数；
+// 不是升级启动时返回0；*channel为之后handoff_ready要用的socket，否则为-1
+int handoff_receive(int* listenfds, int max, int* channel);
+
+// 新进程：反应堆已开始监听，通知旧进程可以排空退出
+void handoff_ready(int channel);
+
+#endif
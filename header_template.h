@@ -0,0 +1,99 @@
+#ifndef HEADER_TEMPLATE_H
+#define HEADER_TEMPLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+编译期生成的响应头片段：状态行、固定的头部组合和错误响应在编译期拼成字节数组，
+运行时生成一个响应头只需要几次memcpy，数字用两位一组查表的itoa写入，不再逐个字段调用vsnprintf。
+*/
+
+// 编译期的定长字节串，不以'\0'结尾
+template <size_t N>
+struct const_bytes
+{
+    char data[N];
+    static constexpr size_t size = N;
+};
+
+// 字符串字面量（去掉结尾的'\0'）
+template <size_t N>
+constexpr const_bytes<N - 1> literal( const char ( &s )[N] ){
+    const_bytes<N - 1> out = {};
+    for( size_t i = 0; i < N - 1; i++ ){
+        out.data[i] = s[i];
+    }
+    return out;
+}
+
+constexpr size_t decimal_digits( uint64_t v ){
+    size_t n = 1;
+    while( v >= 10 ){
+        v /= 10;
+        n++;
+    }
+    return n;
+}
+
+// 编译期已知的数的十进制表示，如错误页的Content-Length
+template <uint64_t V>
+constexpr const_bytes<decimal_digits( V )> decimal(){
+    const_bytes<decimal_digits( V )> out = {};
+    uint64_t v = V;
+    for( size_t i = out.size; i > 0; i-- ){
+        out.data[i - 1] = '0' + v % 10;
+        v /= 10;
+    }
+    return out;
+}
+
+// 按顺序拼接若干片段
+template <size_t... N>
+constexpr const_bytes<( 0 + ... + N )> join( const const_bytes<N>&... parts ){
+    const_bytes<( 0 + ... + N )> out = {};
+    size_t pos = 0;
+    ( [&]{
+        for( size_t i = 0; i < N; i++ ){
+            out.data[pos++] = parts.data[i];
+        }
+    }(), ... );
+    return out;
+}
+
+// "00" "01" ... "99"
+constexpr const_bytes<200> digit_pairs(){
+    const_bytes<200> out = {};
+    for( int i = 0; i < 100; i++ ){
+        out.data[ 2 * i ] = '0' + i / 10;
+        out.data[ 2 * i + 1 ] = '0' + i % 10;
+    }
+    return out;
+}
+
+// 把v的十进制表示写到p（不加'\0'），返回写入的字节数，至多20字节
+inline size_t write_decimal( char* p, uint64_t v ){
+    static constexpr const_bytes<200> pairs = digit_pairs();
+    char buf[20];
+    char* q = buf + sizeof( buf );
+    while( v >= 100 ){
+        const char* d = pairs.data + ( v % 100 ) * 2;
+        v /= 100;
+        *--q = d[1];
+        *--q = d[0];
+    }
+    if( v >= 10 ){
+        const char* d = pairs.data + v * 2;
+        *--q = d[1];
+        *--q = d[0];
+    }
+    else{
+        *--q = '0' + v;
+    }
+    size_t n = buf + sizeof( buf ) - q;
+    memcpy( p, q, n );
+    return n;
+}
+
+#endif
@@ -1,18 +1,49 @@
 #include "http_conn.h"
+#include "http_parser.h"
+#include "config.h"
+#include "threadpool.h"
 
 // 响应状态信息
-const char* ok_200_title = "200 OK";
-const char* error_400_title = "400 Bad Request";
-const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "403 Forbidden";
-const char* error_403_form = "You do not have enough permission to get file from this server.\n";
-const char* error_404_title = "404 Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "500 Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
-// 网站根目录
-const char* doc_root = "./www/";
-// 传入fd设置为非阻塞IO
+constexpr char ok_200_title[] = "200 OK";
+constexpr char ok_206_title[] = "206 Partial Content";
+constexpr char ok_304_title[] = "304 Not Modified";
+constexpr char error_400_title[] = "400 Bad Request";
+constexpr char error_400_form[] = "Your request has bad syntax or is inherently impossible to satisfy.\n";
+constexpr char error_403_title[] = "403 Forbidden";
+constexpr char error_403_form[] = "You do not have enough permission to get file from this server.\n";
+constexpr char error_404_title[] = "404 Not Found";
+constexpr char error_404_form[] = "The requested file was not found on this server.\n";
+constexpr char error_416_title[] = "416 Range Not Satisfiable";
+constexpr char error_500_title[] = "500 Internal Error";
+constexpr char error_500_form[] = "There was an unusual problem serving the requested file.\n";
+
+// 状态行
+template< size_t T >
+static constexpr auto status_line( const char ( &title )[T] ){
+    return join( literal( "HTTP/1.1 " ), literal( title ), literal( "\r\n" ) );
+}
+// 错误响应中Connection之前的部分，Content-Length在编译期算好
+template< size_t T, size_t F >
+static constexpr auto error_head( const char ( &title )[T], const char ( & )[F] ){
+    return join( status_line( title ), literal( "Content-Length: " ), decimal< F - 1 >(), literal( "\r\nContent-Type:text/html\r\n" ) );
+}
+static constexpr auto status_200 = status_line( ok_200_title );
+static constexpr auto status_206 = status_line( ok_206_title );
+static constexpr auto status_304 = status_line( ok_304_title );
+static constexpr auto status_416 = status_line( error_416_title );
+static constexpr auto error_400_head = error_head( error_400_title, error_400_form );
+static constexpr auto error_403_head = error_head( error_403_title, error_403_form );
+static constexpr auto error_404_head = error_head( error_404_title, error_404_form );
+static constexpr auto error_500_head = error_head( error_500_title, error_500_form );
+// Connection字段和结束头部的空行
+static constexpr auto keep_alive_end = literal( "Connection: keep-alive\r\n\r\n" );
+static constexpr auto close_end = literal( "Connection: close\r\n\r\n" );
+static constexpr auto content_length_field = literal( "Content-Length: " );
+static constexpr auto content_range_field = literal( "Content-Range: bytes " );
+static constexpr auto crlf = literal( "\r\n" );
+// 运行指标的保留URL
+const char* stats_url = "/__stats";
+// 传入fd设置为非阻塞IO，连接由accept4直接创建为非阻塞，只有交接过来的监听socket需要
 int setnonblocking(int fd){
     int old_option = fcntl( fd, F_GETFL ); //fcntl针对描述符提供控制
     int new_option = old_option | O_NONBLOCK;
@@ -20,54 +51,90 @@ int setnonblocking(int fd){
     return old_option;
 }
 // 将需要监听的socket加入epoll例程
-void addfd(int epollfd, int fd, bool one_shot){
+// ptr为事件对应的对象（连接），监听socket为NULL
+// edge为true时以边沿触发同时监听读写，此后不再需要modfd；fd必须已经是非阻塞的
+void addfd(int epollfd, int fd, bool one_shot, void* ptr, bool edge){
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
     event.events = EPOLLIN | EPOLLRDHUP;
     if(one_shot){
         event.events |= EPOLLONESHOT; // 防止不同的线程或者进程在处理同一个SOCKET的事件
     }
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd); // 设置文件描述符非阻塞
+    if(edge){
+        event.events |= EPOLLOUT | EPOLLET;
+    }
+    if(epollfd >= 0){ // io_uring引擎的连接不注册在epoll中，epollfd为-1
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    }
 }
 
 // 将fd从epoll例程中移除
 void removefd(int epollfd, int fd){
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    if(epollfd >= 0){
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    }
     close(fd);
 }
 
 //重置socket上的EPOLLONESHOT事件，以确保下一次可读时，EPOLLIN事件能被触发
-void modfd(int epollfd, int fd, int ev){
+void modfd(int epollfd, int fd, int ev, void* ptr){
+    if(epollfd < 0){
+        return;
+    }
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP; // 再把EPOLLONESHOT加回来（因为已经触发过一次了） 
     epoll_ctl( epollfd, EPOLL_CTL_MOD, fd, &event ); // 参数准备齐全，修改指定的epoll文件描述符上的事件
 }
 
-int http_conn::m_user_count = 0; // 记录所有的客户数
-int http_conn::m_epollfd = -1; // 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
+// 单次触发模式下重新注册事件；边沿触发时读写事件一直有效，什么也不做
+void http_conn::rearm( int ev ){
+    if( !m_edge ){
+        modfd( m_epollfd, m_sockfd, ev, this );
+    }
+}
+
+std::atomic<int> http_conn::m_user_count( 0 ); // 记录所有的客户数
+file_cache* http_conn::m_file_cache = NULL;
+int http_conn::m_max_request_size = MAX_REQUEST_KB * 1024;
+const char* http_conn::m_doc_root = "./www";
+const pool_stats* http_conn::m_pool_stats = NULL;
+std::atomic<bool> http_conn::m_draining( false );
+io_pool* http_conn::m_io_pool = NULL;
+size_t http_conn::m_readahead = 0;
 
 //关闭http连接
 void http_conn::close_conn(){
     if( m_sockfd != -1){
         //modfd( m_epollfd, m_sockfd, EPOLLIN );
         removefd(m_epollfd, m_sockfd); // 将m_sockfd从m_epollfd中移除，不再监听
+        close_file(); // 响应未发送完就断开时，同样要释放目标文件
+        m_buffers->release( m_read_buf, m_read_size );
+        m_read_buf = NULL;
+        m_read_size = 0;
+        m_write_chain.release();
         m_sockfd = -1; // 标记作用，-1代表已关闭
         m_user_count--;  // 关闭一个连接，将客户总数量-1
     }
 }
 
+bool http_conn::input_pending() const{
+    char c;
+    return recv( m_sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT ) > 0;
+}
+
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init( int sockfd, const sockaddr_in& addr){
+void http_conn::init( int sockfd, const sockaddr_in& addr, int epollfd, buffer_pool* buffers, bool edge){
+    m_epollfd = epollfd;
+    m_edge = edge;
+    m_buffers = buffers;
+    m_write_chain.init( buffers );
     m_sockfd = sockfd;
     m_address = addr;
+    m_io_task.conn = this;
+    m_io_task.done = NULL; // 使用I/O线程池时由反应堆设置
 
-    // 端口复用
-    int reuse = 1;
-    setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-	
-    addfd( m_epollfd, sockfd, true );
+    addfd( m_epollfd, sockfd, !m_edge, this, m_edge );
     m_user_count++;
 
     init(); // 调用自身的重载函数，设置其他参数
@@ -76,6 +143,44 @@ void http_conn::init( int sockfd, const sockaddr_in& addr){
 void http_conn::init(){
     bytes_to_send = 0;
     bytes_have_send = 0;
+    m_start_line = 0;
+    m_checked_idx = 0; 
+    m_read_idx = 0;
+    m_resp_head = 0;
+    m_resp_count = 0;
+    m_parse_pending = false;
+    m_file_pending = false;
+    m_deferred_events = 0;
+    m_read_blocked = true; // 边沿触发下注册时已有的数据会立即触发EPOLLIN
+    memset( m_real_file, '\0', FILENAME_LEN );
+    init_request();
+}
+
+// 连接开始处理请求时借用读缓冲区，解析只访问[0, m_read_idx)，不需要清零；写缓冲区链在生成响应时按需借用
+bool http_conn::acquire_buffers(){
+    if( !m_read_buf ){
+        m_read_buf = m_buffers->acquire( READ_BUFFER_SIZE );
+        m_read_size = m_read_buf ? READ_BUFFER_SIZE : 0;
+    }
+    return m_read_buf != NULL;
+}
+
+// 由反应堆在响应全部发送完、等待下一个请求时调用
+void http_conn::release_buffers(){
+    if( m_read_buf && m_request_start == m_read_idx ){ // 没有读了一半的请求，增长过的缓冲区也还给池，下次从小的开始
+        m_buffers->release( m_read_buf, m_read_size );
+        m_read_buf = NULL;
+        m_read_size = 0;
+        m_read_idx = m_checked_idx = 0;
+        init_request();
+    }
+    if( !writing() ){
+        m_write_chain.release();
+    }
+}
+
+// 只重置单个请求的解析状态，读缓冲区中尚未处理的数据（流水线上的后续请求）保留
+void http_conn::init_request(){
     m_check_state = CHECK_STATE_REQUESTLINE; // 初始状态为检查请求行
     m_linger = false; // 默认不保持连接  Connection : keep-alive保持连接
 
@@ -84,28 +189,87 @@ void http_conn::init(){
     m_version = 0; 
     m_content_length = 0; 
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0; 
-    m_read_idx = 0;
-    m_write_idx = 0;
-    memset( m_read_buf, '\0', READ_BUFFER_SIZE );
-    memset( m_write_buf, '\0', WRITE_BUFFER_SIZE );
-    memset( m_real_file, '\0', FILENAME_LEN );
+    m_accept_encoding = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_range_count = 0;
+    m_start_line = m_checked_idx; // 下一个请求紧接在上一个请求之后
+    m_request_start = m_checked_idx;
+}
+
+// 读缓冲区满时才搬移或增长，缓冲区还有空间时新数据直接追加在后面
+bool http_conn::make_room(){
+    if( m_read_idx < m_read_size ){
+        return true;
+    }
+    if( m_request_start > 0 ){
+        compact();
+        return true;
+    }
+    // 整个缓冲区只是一个未读完的请求（长URL或大量头部），加倍后拷贝过去
+    if( m_read_size >= m_max_request_size ){
+        return false;
+    }
+    int size = m_read_size * 2 < m_max_request_size ? m_read_size * 2 : m_max_request_size;
+    char* buf = m_buffers->acquire( size );
+    if( !buf ){
+        return false;
+    }
+    memcpy( buf, m_read_buf, m_read_idx );
+    char* old = m_read_buf;
+    m_read_buf = buf;
+    rebase( old, 0 );
+    m_buffers->release( old, m_read_size );
+    m_read_size = size;
+    return true;
+}
+
+// 把当前请求及之后的数据移到读缓冲区开头，已解析出的指针随之平移
+void http_conn::compact(){
+    int shift = m_request_start;
+    if( shift == 0 ){
+        return;
+    }
+    memmove( m_read_buf, m_read_buf + shift, m_read_idx - shift );
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_request_start = 0;
+    rebase( m_read_buf, shift );
+}
+
+// 指向旧缓冲区old_base中偏移p的指针改为指向当前读缓冲区中偏移p - shift处
+void http_conn::rebase( const char* old_base, int shift ){
+    char** pointers[] = {&m_url, &m_version, &m_host, &m_if_none_match, &m_if_modified_since, &m_range, &m_if_range};
+    for( size_t i = 0; i < sizeof( pointers ) / sizeof( pointers[0] ); i++ ){
+        if( *pointers[i] ){
+            *pointers[i] = m_read_buf + ( *pointers[i] - old_base ) - shift;
+        }
+    }
 }
 
 // 循环读取客户数据，直到无数据可读或者对方关闭连接
 bool http_conn::read(){
-    if( m_read_idx >= READ_BUFFER_SIZE ){
+    if( !acquire_buffers() ){
         return false;
     }
+    if( !make_room() ){
+        return false; // 一个请求超过了读缓冲区的上限
+    }
 
     int bytes_read = 0;
-    while( true ){   
-        // 从m_read_buf + m_read_idx索引处开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv( m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0 );
+    m_read_blocked = false;
+    // 缓冲区读满就先停下，解析并发送掉已有的流水线请求后，EPOLLIN会再次触发（边沿触发时由反应堆接着读）；
+    // 解析时发现请求不完整，下一次read()再增长缓冲区
+    while( m_read_idx < m_read_size ){   
+        // 从m_read_buf + m_read_idx索引处开始保存数据，大小是m_read_size - m_read_idx
+        bytes_read = recv( m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0 );
         if (bytes_read == -1){
             if( errno == EAGAIN || errno == EWOULDBLOCK ){
                 // 没有数据
+                m_read_blocked = true;
                 break;
             }
             return false;
@@ -116,15 +280,38 @@ bool http_conn::read(){
 
         m_read_idx += bytes_read;
     }
+    m_read_ns = metrics::now_ns(); // 访问日志中的耗时从读到请求算起
     return true;
 }
 
+// io_uring引擎收到的数据拷入读缓冲区，返回拷入的字节数（缓冲区满且达到上限时为0），借不到缓冲区时返回-1
+int http_conn::fill( const char* data, int len ){
+    if( !acquire_buffers() ){
+        return -1;
+    }
+    if( !make_room() ){
+        return 0;
+    }
+    int n = m_read_size - m_read_idx;
+    if( n > len ){
+        n = len;
+    }
+    memcpy( m_read_buf + m_read_idx, data, n );
+    m_read_idx += n;
+    m_read_ns = metrics::now_ns();
+    return n;
+}
+
 //从状态机，读取当前行，返回对应状态
 http_conn::LINE_STATUS http_conn::parse_line(){
     char temp;
     // m_read_idx指向缓冲区m_read_buf的数据末尾的下一个字节
     // m_checked_idx指向从状态机当前正在分析的字节
-    for ( ; m_checked_idx < m_read_idx; ++m_checked_idx ){
+    if ( m_checked_idx < m_read_idx ){
+        // 向量化地跳到下一个\r或\n，中间的普通字节不再逐个判断
+        m_checked_idx = find_char2( m_read_buf + m_checked_idx, m_read_buf + m_read_idx, '\r', '\n' ) - m_read_buf;
+    }
+    if ( m_checked_idx < m_read_idx ){
 		// 获得当前要分析的字节
         temp = m_read_buf[m_checked_idx];
 		// 如果当前的字节是"\r"，则说明可能读取到一个完整的行
@@ -135,6 +322,7 @@ http_conn::LINE_STATUS http_conn::parse_line(){
             }
             // 下一个字符是\n，将\r\n改为\0\0
             else if ( m_read_buf[ m_checked_idx + 1 ] == '\n' ){
+                set_line_end( m_checked_idx );
                 m_read_buf[ m_checked_idx++ ] = '\0';
                 m_read_buf[ m_checked_idx++ ] = '\0';
                 return LINE_OK;
@@ -146,6 +334,7 @@ http_conn::LINE_STATUS http_conn::parse_line(){
         else if( temp == '\n' ){
             //前一个字符是\r，则接收完整
             if( ( m_checked_idx > 1 ) && ( m_read_buf[ m_checked_idx - 1 ] == '\r' ) ){
+                set_line_end( m_checked_idx - 1 );
                 m_read_buf[ m_checked_idx-1 ] = '\0';
                 m_read_buf[ m_checked_idx++ ] = '\0';
                 return LINE_OK;
@@ -156,13 +345,19 @@ http_conn::LINE_STATUS http_conn::parse_line(){
     return LINE_OPEN;
 }
 
+// 记录当前行作为C字符串的结束位置：行内若有'\0'，字符串在第一个'\0'处结束，与strpbrk等函数的行为一致
+void http_conn::set_line_end( int cr_idx ){
+    const char* begin = m_read_buf + m_start_line;
+    m_line_end = ( char* )find_char2( begin, m_read_buf + cr_idx, '\0', '\0' );
+}
+
 // 解析HTTP请求行，获得请求方法、目标URL，以及HTTP版本号
 http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
 {
     // 请求行中最先含有空格和\t任一字符的位置并返回
-    m_url = strpbrk( text, " \t" );
+    m_url = ( char* )find_char2( text, m_line_end, ' ', '\t' );
 	// 如果请求行中没有空白字符或“\t”，则报文格式有问题
-    if (! m_url){
+    if ( m_url == m_line_end ){
         return BAD_REQUEST;
     }
     *m_url++ = '\0'; // 用于将前面的数据取出
@@ -180,8 +375,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
     // 不断后移找到请求资源的第一个字符
     // m_url += strspn( m_url, " \t" );
     // 判断http的版本号
-    m_version = strpbrk( m_url, " \t" );
-    if ( ! m_version ){
+    m_version = ( char* )find_char2( m_url, m_line_end, ' ', '\t' );
+    if ( m_version == m_line_end ){
         return BAD_REQUEST;
     }
     *m_version++ = '\0';
@@ -199,10 +394,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line( char* text )
     if ( ! m_url || m_url[ 0 ] != '/' ){
         return BAD_REQUEST;
     }
-    //当url为/时，显示首页
-    if (strlen(m_url) == 1)
-        strcat(m_url, "index.html");
-
     m_check_state = CHECK_STATE_HEADER; // 状态转移
     return NO_REQUEST;
 }
@@ -223,33 +414,67 @@ http_conn::HTTP_CODE http_conn::parse_headers( char* text ){
 		// 否则说明我们已经得到了一个完整的GET请求
         return GET_REQUEST;
     }
-	/*处理头部Connection字段*/
-    else if ( strncasecmp( text, "Connection:", 11 ) == 0 )
+
+    // 找到字段名后的冒号，按字段名长度和完美哈希识别已知字段，代替逐个strncasecmp
+    const char* colon = find_char2( text, m_line_end, ':', ':' );
+    HEADER_ID id = ( colon == m_line_end ) ? HEADER_UNKNOWN : lookup_header( text, colon - text );
+    char* value = text + ( colon - text ) + 1;
+    switch ( id )
     {
-        text += 11;
-        text += strspn( text, " \t" );
-        if ( strcasecmp( text, "keep-alive" ) == 0 )
+        /*处理头部Connection字段*/
+        case HEADER_CONNECTION:
         {
-            m_linger = true;
+            value += strspn( value, " \t" );
+            if ( strcasecmp( value, "keep-alive" ) == 0 )
+            {
+                m_linger = true;
+            }
+            break;
+        }
+        /*处理Content-Length字段*/
+        case HEADER_CONTENT_LENGTH:
+        {
+            value += strspn( value, " \t" );
+            m_content_length = atol( value );
+            break;
+        }
+        /*处理Host头部字段*/
+        case HEADER_HOST:
+        {
+            value += strspn( value, " \t" );
+            m_host = value;
+            break;
+        }
+        case HEADER_ACCEPT_ENCODING:
+        {
+            m_accept_encoding = parse_accept_encoding( value );
+            break;
+        }
+        /*条件请求和Range只记下取值，取得文件后由check_conditions判断*/
+        case HEADER_IF_NONE_MATCH:
+        {
+            m_if_none_match = value + strspn( value, " \t" );
+            break;
+        }
+        case HEADER_IF_MODIFIED_SINCE:
+        {
+            m_if_modified_since = value + strspn( value, " \t" );
+            break;
+        }
+        case HEADER_RANGE:
+        {
+            m_range = value + strspn( value, " \t" );
+            break;
+        }
+        case HEADER_IF_RANGE:
+        {
+            m_if_range = value + strspn( value, " \t" );
+            break;
+        }
+        default:
+        {
+            break;  // 其余头部字段不处理
         }
-    }
-	/*处理Content-Length字段*/
-    else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 )
-    {
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol( text );
-    }
-	/*处理Host头部字段*/
-    else if ( strncasecmp( text, "Host:", 5 ) == 0 )
-    {
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
-    }
-    else
-    {
-        printf( "oop! unknow header %s\n", text );
     }
 
     return NO_REQUEST;
@@ -260,7 +485,9 @@ http_conn::HTTP_CODE http_conn::parse_content( char* text ){
     //判断是否读取了消息体
     if ( m_read_idx >= ( m_content_length + m_checked_idx ) )
     {
-        text[ m_content_length ] = '\0';
+        // 跳过消息体，流水线上的下一个请求从其后开始（不能再写入'\0'，那是下一个请求的第一个字节）
+        m_checked_idx += m_content_length;
+        m_start_line = m_checked_idx;
         return GET_REQUEST;
     }
 
@@ -280,7 +507,6 @@ http_conn::HTTP_CODE http_conn::process_read(){
         // m_start_line是每一个数据行在m_read_buf中的起始位置
         // m_checked_idx表示从状态机在m_read_buf中的读取位置
         m_start_line = m_checked_idx;
-        printf( "got a http line: %s\n", text );
 
         switch (m_check_state)
         {
@@ -323,154 +549,497 @@ http_conn::HTTP_CODE http_conn::process_read(){
 
 // 返回对请求目标文件的分析结果
 http_conn::HTTP_CODE http_conn::do_request(){
-    strcpy( m_real_file, doc_root ); //将初始化的m_real_file赋值为网站根目录
-    int len = strlen( doc_root );
-    strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
-    // 没有想要的文件
-    if ( stat( m_real_file, &m_file_stat ) < 0 )
+    if( strcmp( m_url, stats_url ) == 0 ){
+        return STATS_REQUEST;
+    }
+    strcpy( m_real_file, m_doc_root ); //将初始化的m_real_file赋值为网站根目录
+    int len = strlen( m_doc_root );
+    //当url为/时，显示首页（不能在读缓冲区里原地拼接，会覆盖流水线上的下一个请求）
+    const char* url = ( strcmp( m_url, "/" ) == 0 ) ? "/index.html" : m_url;
+    strncpy( m_real_file + len, url, FILENAME_LEN - len - 1 );
+    file_cache::STATUS status;
+    if( m_file_pending ) // I/O线程已经取得目标文件
+    {
+        m_file_pending = false;
+        status = m_file_status;
+    }
+    else if( m_io_task.done )
     {
-        return NO_RESOURCE;
+        // 只查缓存，需要访问磁盘时交给I/O线程池
+        uint64_t start = metrics::now_ns();
+        status = m_file_cache->try_acquire( m_real_file, &m_file, m_range ? 0 : m_accept_encoding );
+        metrics::observe( HISTOGRAM_FILE_OPEN, metrics::now_ns() - start );
+        if( status == file_cache::FILE_WOULD_BLOCK )
+        {
+            m_file_pending = true;
+            return FILE_PENDING;
+        }
     }
-    // 没有权限读取
-    if ( ! ( m_file_stat.st_mode & S_IROTH ) )
+    else
     {
-        return FORBIDDEN_REQUEST;
+        load_file();
+        status = m_file_status;
     }
-    // 请求的资源文件是目录文件
-    if ( S_ISDIR( m_file_stat.st_mode ) )
+    switch ( status )
     {
-        return BAD_REQUEST;
+        case file_cache::FILE_OK:
+            break;
+        case file_cache::FILE_NOT_FOUND: // 没有想要的文件
+            return NO_RESOURCE;
+        case file_cache::FILE_FORBIDDEN: // 没有权限读取
+            return FORBIDDEN_REQUEST;
+        case file_cache::FILE_IS_DIR: // 请求的资源文件是目录文件
+            return BAD_REQUEST;
+        default:
+            return INTERNAL_ERROR;
     }
+    m_file_stat = m_file->st;
+    return check_conditions();
+}
 
-    int fd = open( m_real_file, O_RDONLY );
-    // 通过调用mmap将文件映射到内存逻辑地址，提高访问速度
-    m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-    close( fd );
-    return FILE_REQUEST;
+// 从文件缓存获取目标文件，未命中时从磁盘加载；大文件用readahead把要发送的开头读进页缓存，随后的sendfile不必等磁盘
+void http_conn::load_file(){
+    uint64_t start = metrics::now_ns();
+    // 区间按未压缩的内容计算，带Range的请求不协商压缩
+    m_file_status = m_file_cache->acquire( m_real_file, &m_file, m_range ? 0 : m_accept_encoding );
+    if( m_file_status == file_cache::FILE_OK && m_file->fd != -1 && m_readahead > 0 )
+    {
+        off_t offset = 0;
+        byte_range ranges[MAX_RANGES];
+        if( m_range && parse_byte_ranges( m_range, m_file->st.st_size, ranges, MAX_RANGES ) > 0 )
+        {
+            offset = ranges[0].start;
+        }
+        readahead( m_file->fd, offset, m_readahead );
+    }
+    metrics::observe( HISTOGRAM_FILE_OPEN, metrics::now_ns() - start );
 }
-//封装munmap系统调用
-void http_conn::unmap(){
-    if( m_file_address )
+
+http_conn::HTTP_CODE http_conn::check_conditions(){
+    // If-None-Match存在时忽略If-Modified-Since
+    if( m_if_none_match )
+    {
+        if( etag_list_matches( m_if_none_match, m_file->etag ) )
+        {
+            return NOT_MODIFIED;
+        }
+    }
+    else if( m_if_modified_since )
+    {
+        time_t since;
+        if( parse_http_date( m_if_modified_since, &since ) && m_file_stat.st_mtime <= since )
+        {
+            return NOT_MODIFIED;
+        }
+    }
+    if( !m_range )
     {
-        munmap( m_file_address, m_file_stat.st_size );
-        m_file_address = 0;
+        return FILE_REQUEST;
     }
+    // If-Range不匹配（文件已变化）时发送整个文件；只接受强校验器或与Last-Modified完全相同的日期
+    if( m_if_range )
+    {
+        time_t date;
+        bool match = ( m_if_range[0] == '"' ) ? strcmp( m_if_range, m_file->etag ) == 0
+                     : ( parse_http_date( m_if_range, &date ) && date == m_file_stat.st_mtime );
+        if( !match )
+        {
+            return FILE_REQUEST;
+        }
+    }
+    int count = parse_byte_ranges( m_range, m_file_stat.st_size, m_ranges, MAX_RANGES );
+    if( count < 0 ) // 无法解析的Range按没有处理
+    {
+        return FILE_REQUEST;
+    }
+    if( count == 0 )
+    {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    m_range_count = count;
+    return PARTIAL_CONTENT;
+}
+//归还当前请求和所有排队响应引用的文件缓存条目
+void http_conn::close_file(){
+    if( m_file )
+    {
+        file_cache::release( m_file );
+        m_file = NULL;
+    }
+    for( int i = m_resp_head; i < m_resp_count; i++ )
+    {
+        if( m_responses[i].file )
+        {
+            file_cache::release( m_responses[i].file );
+            m_responses[i].file = NULL;
+        }
+        free( m_responses[i].body );
+        m_responses[i].body = NULL;
+        free( m_responses[i].chunks );
+        m_responses[i].chunks = NULL;
+    }
+    m_resp_head = m_resp_count = 0;
 }
 
-// 写HTTP响应
+/*
+写HTTP响应：把队列中多个流水线响应的头部和内存中的文件内容拼成一次writev发送，
+遇到大文件时先发送其响应头（带MSG_MORE），再用sendfile从缓存的fd发送文件内容
+*/
 bool http_conn::write(){
-    int temp = 0;
-    if ( bytes_to_send == 0 ) // 将要发送的字节为0，这一次响应结束
+    uint64_t start = metrics::now_ns();
+    bool ret = write_responses();
+    metrics::observe( HISTOGRAM_WRITE, metrics::now_ns() - start );
+    return ret;
+}
+
+bool http_conn::write_responses(){
+    ssize_t temp = 0;
+    if ( m_resp_head == m_resp_count ) // 没有待发送的响应
     {
-        modfd( m_epollfd, m_sockfd, EPOLLIN ); 
-        init();
+        rearm( EPOLLIN ); 
         return true;
     }
 
     while( 1 )
     {
-        temp = writev( m_sockfd, m_iv, m_iv_count );
+        if ( sending_file() )
+        {
+            temp = send_file();
+        }
+        else
+        {
+            struct iovec iv[ MAX_IOV ];
+            bool more = false;
+            struct msghdr msg;
+            memset( &msg, 0, sizeof( msg ) );
+            msg.msg_iov = iv;
+            msg.msg_iovlen = gather( iv, &more );
+            // 后面紧跟sendfile时带上MSG_MORE，让响应头和文件开头合并成满的报文段
+            temp = sendmsg( m_sockfd, &msg, more ? MSG_MORE : 0 );
+        }
         if ( temp <= -1 )
         {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN )
             {
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
+                metrics::add( COUNTER_EPOLLOUT_REARMS );
+                rearm( EPOLLOUT );
                 return true;
             }
-			/*发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接*/
-            unmap();
+            close_file();
             return false;
         }
+        if ( temp == 0 ) // 文件在发送过程中被截断，无法再发送出声明的长度
+        {
+            close_file();
+            return false;
+        }
+        if ( !advance( temp ) )
+        {
+            return false;
+        }
+        if ( !writing() )
+        {
+            if ( !m_parse_pending )
+            {
+                rearm( EPOLLIN );
+            }
+            return true;
+        }
+    }
+}
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
+const http_conn::chunk* http_conn::find_chunk( const response& r, off_t* skip ) const{
+    off_t body_sent = r.sent - r.head_len;
+    const chunk* c = r.body_chunks();
+    for ( int k = 0; k < r.chunk_count; k++ )
+    {
+        if ( body_sent < c[k].len )
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            *skip = body_sent;
+            return &c[k];
         }
-        else
+        body_sent -= c[k].len;
+    }
+    return NULL;
+}
+
+bool http_conn::sending_file() const{
+    const response& first = m_responses[ m_resp_head ];
+    off_t skip;
+    if ( !first.file || first.sent < ( size_t )first.head_len )
+    {
+        return false;
+    }
+    const chunk* c = find_chunk( first, &skip );
+    return c && !c->data;
+}
+
+ssize_t http_conn::send_file(){
+    // sendfile使用显式偏移，fd被多个连接共享，不依赖文件位置；EAGAIN后下一次可写时从sent处继续
+    response& first = m_responses[ m_resp_head ];
+    off_t skip = 0;
+    const chunk* c = find_chunk( first, &skip );
+    off_t offset = c->offset + skip;
+    return sendfile( m_sockfd, first.file->fd, &offset, c->len - skip );
+}
+
+int http_conn::gather( struct iovec* iv, bool* more ){
+    int iv_count = 0;
+    *more = false;
+    for ( int i = m_resp_head; i < m_resp_count && iv_count < MAX_IOV; i++ )
+    {
+        response& r = m_responses[i];
+        size_t head_left = r.sent < ( size_t )r.head_len ? r.head_len - r.sent : 0;
+        if ( head_left > 0 )
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            iv[ iv_count ].iov_base = ( char* )r.head + r.sent;
+            iv[ iv_count ].iov_len = head_left;
+            iv_count++;
         }
-        if ( bytes_to_send <= 0 )
+        // 依次加入未发送完的内存片段，遇到要sendfile的文件片段时本批到此为止
+        off_t body_sent = r.sent - ( r.head_len - head_left );
+        const chunk* c = r.body_chunks();
+        for ( int k = 0; k < r.chunk_count; k++ )
         {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-            if( m_linger )
+            if ( body_sent >= c[k].len )
             {
-                init();
-                return true;
+                body_sent -= c[k].len;
+                continue;
+            }
+            if ( !c[k].data )
+            {
+                *more = true;
+                return iv_count;
+            }
+            if ( iv_count == MAX_IOV )
+            {
+                return iv_count;
             }
-            else
+            iv[ iv_count ].iov_base = ( char* )c[k].data + body_sent;
+            iv[ iv_count ].iov_len = c[k].len - body_sent;
+            iv_count++;
+            body_sent = 0;
+        }
+    }
+    return iv_count;
+}
+
+bool http_conn::advance( size_t sent ){
+    metrics::add( COUNTER_BYTES_SENT, sent );
+    bytes_to_send -= sent;
+    bytes_have_send += sent;
+    // 按发送的字节数依次推进各个响应，发送完的响应归还文件缓存条目
+    size_t left = sent;
+    while ( left > 0 )
+    {
+        response& r = m_responses[ m_resp_head ];
+        size_t total = r.head_len + r.body_len;
+        size_t step = ( total - r.sent < left ) ? total - r.sent : left;
+        r.sent += step;
+        left -= step;
+        if ( r.sent == total )
+        {
+            if ( r.file )
             {
+                file_cache::release( r.file );
+                r.file = NULL;
+            }
+            free( r.body );
+            r.body = NULL;
+            free( r.chunks );
+            r.chunks = NULL;
+            m_resp_head++;
+			/*发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接*/
+            if ( !r.linger )
+            {
+                close_file();
                 return false;
-            } 
+            }
         }
     }
+    if ( m_resp_head == m_resp_count )
+    {
+        // 本批响应全部发送完毕，写缓冲区链可以重新使用
+        m_resp_head = m_resp_count = 0;
+        m_write_chain.reset();
+        bytes_to_send = 0;
+        bytes_have_send = 0;
+    }
+    return true;
 }
-/*往写缓冲区写入待发送的数据*/
-bool http_conn::add_response(const char* format, ...){
-    if( m_write_idx >= WRITE_BUFFER_SIZE )
+/*往写缓冲区写入待发送的数据：响应开始前已在当前片中预留了RESPONSE_RESERVE字节，一个响应头总是连续的*/
+bool http_conn::add_bytes( const char* data, size_t len ){
+    if( len >= m_write_chain.room() )
     {
         return false;
     }
-    va_list arg_list;
-    va_start( arg_list, format );
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) )
+    memcpy( m_write_chain.end(), data, len );
+    m_write_chain.commit( len );
+    return true;
+}
+
+bool http_conn::add_number( uint64_t value ){
+    if( m_write_chain.room() <= 20 )
     {
         return false;
     }
-    m_write_idx += len;
-    va_end( arg_list );
-    //printf("request:%s", m_write_buf);
+    m_write_chain.commit( write_decimal( m_write_chain.end(), value ) );
     return true;
 }
 
-bool http_conn::add_status_line( int status, const char* title ){
-    return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
+bool http_conn::add_content_length( off_t content_len ){
+    return add_bytes( content_length_field ) && add_number( content_len ) && add_bytes( crlf );
 }
 
-bool http_conn::add_headers( int content_len ){
-    bool a = add_content_length( content_len );
-    bool b = add_content_type();
-    bool c = add_linger();
-    bool d = add_blank_line();
-    return a && b && c && d;
+bool http_conn::add_linger(){
+    return m_linger ? add_bytes( keep_alive_end ) : add_bytes( close_end );
 }
 
-bool http_conn::add_content_length( int content_len ){
-    return add_response( "Content-Length: %d\r\n", content_len );
+bool http_conn::add_error( const char* head, size_t head_len, const char* form, size_t form_len ){
+    return add_bytes( head, head_len ) && add_linger() && add_bytes( form, form_len );
 }
 
-bool http_conn::add_linger(){
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
+bool http_conn::add_file_fields(){
+    return add_bytes( m_file->header + m_file->fields_start, m_file->header_len - m_file->fields_start );
 }
 
-bool http_conn::add_blank_line(){
-    return add_response( "%s", "\r\n" );
+bool http_conn::add_ranges( chunk** chunks, off_t* body_len ){
+    off_t size = m_file_stat.st_size;
+    if ( ! add_bytes( status_206 ) )
+    {
+        return false;
+    }
+    // 任何一段写不下都放弃整个响应，不能发出缺少字段的响应头
+    if ( m_range_count == 1 )
+    {
+        const byte_range& range = m_ranges[0];
+        *body_len = range.end - range.start + 1;
+        return add_content_length( *body_len ) && add_bytes( content_range_field )
+               && add_number( range.start ) && add_bytes( "-", 1 ) && add_number( range.end )
+               && add_bytes( "/", 1 ) && add_number( size ) && add_bytes( crlf )
+               && add_bytes( "Content-Type:", 13 ) && add_bytes( m_file->content_type, strlen( m_file->content_type ) )
+               && add_bytes( crlf ) && add_file_fields() && add_linger();
+    }
+
+    // multipart/byteranges：每个区间前是一段分隔头，最后是结束分隔符；片段表和分隔头放在同一块内存中
+    char boundary[32];
+    snprintf( boundary, sizeof( boundary ), "%016llx", ( unsigned long long )metrics::now_ns() );
+    int count = m_range_count * 2 + 1;
+    size_t text_cap = m_range_count * ( 160 + strlen( m_file->content_type ) ) + 32;
+    char* mem = ( char* )malloc( sizeof( chunk ) * count + text_cap );
+    if ( !mem )
+    {
+        return false;
+    }
+    chunk* c = ( chunk* )mem;
+    char* text = mem + sizeof( chunk ) * count;
+    size_t used = 0;
+    off_t total = 0;
+    for ( int i = 0; i <= m_range_count; i++ )
+    {
+        int len;
+        if ( i < m_range_count )
+        {
+            const byte_range& range = m_ranges[i];
+            len = snprintf( text + used, text_cap - used, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                            boundary, m_file->content_type, ( long long )range.start, ( long long )range.end, ( long long )size );
+        }
+        else
+        {
+            len = snprintf( text + used, text_cap - used, "\r\n--%s--\r\n", boundary );
+        }
+        c[ 2 * i ].data = text + used;
+        c[ 2 * i ].offset = 0;
+        c[ 2 * i ].len = len;
+        used += len;
+        total += len;
+        if ( i < m_range_count )
+        {
+            const byte_range& range = m_ranges[i];
+            chunk& part = c[ 2 * i + 1 ];
+            part.data = m_file->data ? m_file->data + range.start : NULL;
+            part.offset = range.start;
+            part.len = range.end - range.start + 1;
+            total += part.len;
+        }
+    }
+    *chunks = c;
+    *body_len = total;
+    return add_content_length( total ) && add_bytes( literal( "Content-Type: multipart/byteranges; boundary=" ) )
+           && add_bytes( boundary, strlen( boundary ) ) && add_bytes( crlf ) && add_file_fields() && add_linger();
 }
 
-bool http_conn::add_content( const char* content ){
-    return add_response( "%s", content );
+/*根据服务器处理HTTP请求的结果，决定返回给客户端的内容*/
+// 写访问日志：只拷贝到本线程的环形缓冲区，格式化和写文件由后台线程完成
+void http_conn::log_request( int status, uint64_t bytes ){
+    if( !access_log::enabled() ){
+        return;
+    }
+    static const char* method_names[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"};
+    access_record rec;
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME_COARSE, &ts );
+    rec.time_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    rec.addr = m_address.sin_addr.s_addr;
+    rec.port = m_address.sin_port;
+    rec.status = status;
+    rec.latency_us = ( metrics::now_ns() - m_read_ns ) / 1000;
+    rec.bytes = bytes;
+    // 语法错误的请求中方法和URL不可信，按Common Log Format记为"-"
+    bool valid = status != 400 && m_url;
+    snprintf( rec.method, sizeof( rec.method ), "%s", valid ? method_names[ m_method ] : "-" );
+    snprintf( rec.url, sizeof( rec.url ), "%s", valid ? m_url : "-" );
+    access_log::record( rec );
 }
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+
+// 运行指标：各线程的计数器和直方图，再加上连接数和文件缓存的统计
+static void render_stats( std::string& out ){
+    metrics::render( out );
+    char line[2048];
+    snprintf( line, sizeof( line ),
+              "# HELP http_connections Open client connections.\n# TYPE http_connections gauge\nhttp_connections %d\n"
+              "# HELP file_cache_hits_total File cache hits.\n# TYPE file_cache_hits_total counter\nfile_cache_hits_total %lu\n"
+              "# HELP file_cache_misses_total File cache misses.\n# TYPE file_cache_misses_total counter\nfile_cache_misses_total %lu\n"
+              "# HELP file_cache_evictions_total File cache evictions.\n# TYPE file_cache_evictions_total counter\nfile_cache_evictions_total %lu\n"
+              "# HELP file_cache_compressions_total Compressed variants produced by the background compressor.\n"
+              "# TYPE file_cache_compressions_total counter\nfile_cache_compressions_total %lu\n"
+              "# HELP access_log_written_total Access log records written.\n# TYPE access_log_written_total counter\naccess_log_written_total %llu\n"
+              "# HELP access_log_dropped_total Access log records dropped because the per-thread buffer was full.\n"
+              "# TYPE access_log_dropped_total counter\naccess_log_dropped_total %llu\n",
+              http_conn::m_user_count.load(), http_conn::m_file_cache->hits(), http_conn::m_file_cache->misses(), http_conn::m_file_cache->evictions(),
+              http_conn::m_file_cache->compressions(),
+              ( unsigned long long )access_log::written(), ( unsigned long long )access_log::dropped() );
+    out += line;
+    const pool_stats* pool = http_conn::m_pool_stats;
+    if( pool ){
+        snprintf( line, sizeof( line ),
+                  "# HELP http_pool_workers Running thread pool workers.\n# TYPE http_pool_workers gauge\nhttp_pool_workers %d\n"
+                  "# HELP http_pool_max_workers Upper bound of the adaptive thread pool.\n# TYPE http_pool_max_workers gauge\nhttp_pool_max_workers %d\n"
+                  "# HELP http_pool_queued Requests waiting in the thread pool queue at the last sample.\n# TYPE http_pool_queued gauge\nhttp_pool_queued %ld\n"
+                  "# HELP http_pool_queue_wait_seconds_estimate Queue wait estimated by the pool controller over the last interval.\n"
+                  "# TYPE http_pool_queue_wait_seconds_estimate gauge\nhttp_pool_queue_wait_seconds_estimate %.6f\n"
+                  "# HELP http_pool_resizes_total Thread pool resizes by direction.\n# TYPE http_pool_resizes_total counter\n"
+                  "http_pool_resizes_total{direction=\"grow\"} %lu\nhttp_pool_resizes_total{direction=\"shrink\"} %lu\n",
+                  pool->workers.load(), pool->max_workers.load(), pool->queued.load(), pool->queue_wait_us.load() / 1e6,
+                  pool->grows.load(), pool->shrinks.load() );
+        out += line;
+    }
 }
-/*根据服务器处理HTTP请求的结果，决定返回给客户端的内容*/
+
 bool http_conn::process_write( HTTP_CODE ret ){
+    int status = 0;
+    char* body = NULL; // 动态生成的响应体
+    off_t body_len = 0;
+    chunk* chunks = NULL; // 多个片段组成的响应体
     switch ( ret )
     {
         case INTERNAL_ERROR:
         {
-            add_status_line( 500, error_500_title );
-            add_headers( strlen( error_500_form ) );
-            if ( ! add_content( error_500_form ) )
+            metrics::add( COUNTER_RESPONSES_500 );
+            status = 500;
+            if ( ! add_error( error_500_head.data, error_500_head.size, error_500_form, sizeof( error_500_form ) - 1 ) )
             {
                 return false;
             }
@@ -478,9 +1047,9 @@ bool http_conn::process_write( HTTP_CODE ret ){
         }
         case BAD_REQUEST:
         {
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) )
+            metrics::add( COUNTER_RESPONSES_400 );
+            status = 400;
+            if ( ! add_error( error_400_head.data, error_400_head.size, error_400_form, sizeof( error_400_form ) - 1 ) )
             {
                 return false;
             }
@@ -488,9 +1057,9 @@ bool http_conn::process_write( HTTP_CODE ret ){
         }
         case NO_RESOURCE:
         {
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( ! add_content( error_404_form ) )
+            metrics::add( COUNTER_RESPONSES_404 );
+            status = 404;
+            if ( ! add_error( error_404_head.data, error_404_head.size, error_404_form, sizeof( error_404_form ) - 1 ) )
             {
                 return false;
             }
@@ -498,74 +1067,196 @@ bool http_conn::process_write( HTTP_CODE ret ){
         }
         case FORBIDDEN_REQUEST:
         {
-            add_status_line( 403, error_403_title );
-            add_headers( strlen( error_403_form ) );
-            if ( ! add_content( error_403_form ) ){
+            metrics::add( COUNTER_RESPONSES_403 );
+            status = 403;
+            if ( ! add_error( error_403_head.data, error_403_head.size, error_403_form, sizeof( error_403_form ) - 1 ) ){
                 return false;
             }
             break;
         }
         case FILE_REQUEST:
         {
-            // add_status_line( 200, ok_200_title );
-            // if ( m_file_stat.st_size != 0 )
-            // {
-            //     add_headers( m_file_stat.st_size );
-            //     m_iv[ 0 ].iov_base = m_write_buf;
-            //     m_iv[ 0 ].iov_len = m_write_idx;
-            //     m_iv[ 1 ].iov_base = m_file_address;
-            //     m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            //     m_iv_count = 2;
-            //     bytes_to_send = m_write_idx + m_file_stat.st_size;
-            //     return true;
-            // }
-            // else
-            // {
-            //     const char* ok_string = "<html><body></body></html>";
-            //     add_headers( strlen( ok_string ) );
-            //     if ( ! add_content( ok_string ) )
-            //     {
-            //         return false;
-            //     }
-            // }
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-
-            return true;
+            metrics::add( COUNTER_RESPONSES_200 );
+            status = 200;
+            // 状态行、Content-Length和Content-Type由缓存预先生成，这里只需拷贝
+            if ( ( size_t )m_file->header_len >= m_write_chain.room() )
+            {
+                return false;
+            }
+            memcpy( m_write_chain.end(), m_file->header, m_file->header_len );
+            m_write_chain.commit( m_file->header_len );
+            if ( ! add_linger() )
+            {
+                return false;
+            }
+            body_len = m_file_stat.st_size;
+            break;
+        }
+        case NOT_MODIFIED:
+        {
+            metrics::add( COUNTER_RESPONSES_304 );
+            status = 304;
+            // 304没有响应体，也不带Content-Length
+            if ( ! add_bytes( status_304 ) || ! add_file_fields() || ! add_linger() )
+            {
+                return false;
+            }
+            file_cache::release( m_file );
+            m_file = NULL;
+            break;
+        }
+        case PARTIAL_CONTENT:
+        {
+            metrics::add( COUNTER_RESPONSES_206 );
+            status = 206;
+            if ( ! add_ranges( &chunks, &body_len ) )
+            {
+                free( chunks );
+                return false;
+            }
+            break;
+        }
+        case RANGE_NOT_SATISFIABLE:
+        {
+            metrics::add( COUNTER_RESPONSES_416 );
+            status = 416;
+            if ( ! add_bytes( status_416 ) || ! add_bytes( literal( "Content-Range: bytes */" ) )
+                 || ! add_number( m_file_stat.st_size ) || ! add_bytes( literal( "\r\nContent-Length: 0\r\n" ) ) || ! add_linger() )
+            {
+                return false;
+            }
+            file_cache::release( m_file );
+            m_file = NULL;
+            break;
+        }
+        case STATS_REQUEST:
+        {
+            metrics::add( COUNTER_RESPONSES_200 );
+            status = 200;
+            std::string text;
+            render_stats( text );
+            if ( ! add_bytes( status_200 ) || ! add_content_length( text.size() )
+                 || ! add_bytes( literal( "Content-Type:text/plain; version=0.0.4\r\n" ) ) || ! add_linger() )
+            {
+                return false;
+            }
+            body = ( char* )malloc( text.size() );
+            if ( !body )
+            {
+                return false;
+            }
+            memcpy( body, text.data(), text.size() );
+            body_len = text.size();
+            break;
         }
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    // 把本次响应加入流水线响应队列，目标文件的引用随之转交
+    response& r = m_responses[ m_resp_count++ ];
+    r.head = m_response_start;
+    r.head_len = m_write_chain.end() - m_response_start;
+    r.file = m_file;
+    r.body = body;
+    r.body_len = body_len;
+    r.chunks = chunks;
+    if ( chunks )
+    {
+        r.chunk_count = m_range_count * 2 + 1;
+    }
+    else
+    {
+        // 整个文件、一个区间或动态生成的响应体
+        r.chunk_count = body_len > 0 ? 1 : 0;
+        off_t offset = ( status == 206 ) ? m_ranges[0].start : 0;
+        const char* data = body ? body : ( m_file ? m_file->data : NULL );
+        r.one.data = data ? data + offset : NULL;
+        r.one.offset = offset;
+        r.one.len = body_len;
+    }
+    r.sent = 0;
+    r.linger = m_linger;
+    m_file = NULL;
+    bytes_to_send += r.head_len + r.body_len;
+    log_request( status, r.head_len + r.body_len );
     return true;
 }
-// 由线程中的工作线程调用，这是处理HTTP请求的入口函数
+/*
+由线程中的工作线程调用，这是处理HTTP请求的入口函数
+一次读入的数据中可能有多个流水线请求，逐个解析并生成响应，直到数据不足一个完整请求
+*/
 void http_conn::process(){
-    HTTP_CODE read_ret = process_read();
-    // NO_REQUEST 表示请求不完整，需要继续接受请求数据
-    if (read_ret == NO_REQUEST)
+    unsigned seq = m_dispatched.load( std::memory_order_acquire );
+    if( m_enqueue_ns )
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN); //注册并监听读事件
-        return;
+        metrics::observe( HISTOGRAM_QUEUE_WAIT, metrics::now_ns() - m_enqueue_ns );
+        m_enqueue_ns = 0;
     }
-    //调用process_write完成报文响应
-    bool write_ret = process_write( read_ret );
-    if ( ! write_ret )
+    if( process_requests() )
     {
-        close_conn();
+        return; // 连接已交给I/O线程池，由加载完后重新分派的那次处理记下序号
     }
-    //注册并监听写事件
-    modfd( m_epollfd, m_sockfd, EPOLLOUT );
+    // process_requests()已重新注册事件，反应堆收到的事件要等这里记下序号后才处理；此后不再访问本连接，反应堆可以安全地关闭它
+    m_processed.store( seq, std::memory_order_release );
 }
 
+bool http_conn::process_requests(){
+    m_parse_pending = false;
+    while ( true )
+    {
+        // 响应队列已满，剩余的请求等这批响应发送完再解析
+        if ( m_resp_count == MAX_PIPELINE )
+        {
+            m_parse_pending = m_checked_idx < m_read_idx;
+            break;
+        }
+        uint64_t start = metrics::now_ns();
+        HTTP_CODE read_ret = m_file_pending ? do_request() : process_read(); // 加载完的请求已经解析过
+        metrics::observe( HISTOGRAM_PARSE, metrics::now_ns() - start );
+        if ( read_ret == FILE_PENDING )
+        {
+            // 所属反应堆在加载完后重新分派本连接，交出后不能再访问它；I/O队列已满时就地加载
+            if ( m_io_pool->append( &m_io_task, m_home ) )
+            {
+                metrics::add( COUNTER_IO_OFFLOADS );
+                return true;
+            }
+            load_file();
+            read_ret = do_request();
+        }
+        // NO_REQUEST 表示请求不完整，需要继续接受请求数据
+        if ( read_ret == NO_REQUEST )
+        {
+            break;
+        }
+        // 请求有语法错误时无法确定下一个请求从哪里开始，服务器停止时不再保持连接，两种情况都回复后关闭连接
+        if ( read_ret == BAD_REQUEST || m_draining.load( std::memory_order_relaxed ) )
+        {
+            m_linger = false;
+        }
+        //调用process_write完成报文响应，响应头写在写缓冲区链中预留的连续空间里
+        m_response_start = m_write_chain.reserve( RESPONSE_RESERVE );
+        if ( ! m_response_start || ! process_write( read_ret ) )
+        {
+            // 连接只能由所属反应堆线程关闭（它还要删除定时器），这里关闭socket的读写，
+            // 反应堆随后收到EPOLLHUP/EPOLLRDHUP时关闭连接
+            shutdown( m_sockfd, SHUT_RDWR );
+            rearm( EPOLLIN );
+            return false;
+        }
+        if ( ! m_linger )
+        {
+            break; // 这个响应发送完后就关闭连接，之后的请求不再处理
+        }
+        init_request();
+    }
+    if ( m_resp_count == 0 )
+    {
+        rearm( EPOLLIN ); //注册并监听读事件
+        return false;
+    }
+    //注册并监听写事件
+    rearm( EPOLLOUT );
+    return false;
+}
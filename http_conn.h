@@ -19,13 +19,29 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <atomic>
 #include "locker.h"
+#include "file_cache.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+#include "buffer_chain.h"
+#include "header_template.h"
+#include "metrics.h"
+#include "access_log.h"
+#include "http_parser.h"
+#include "io_stage.h"
+struct pool_stats;
+
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200;        //文件名最大长度
-    static const int READ_BUFFER_SIZE = 2048;   //读缓冲区大小
-    static const int WRITE_BUFFER_SIZE = 1024;  //写缓冲区大小
+    static const int READ_BUFFER_SIZE = 1024;   //读缓冲区的初始大小，放不下一个完整的请求时按2倍增长，上限为m_max_request_size
+    static const int MAX_PIPELINE = 16;         //一次最多排队的流水线响应数
+    static const int RESPONSE_RESERVE = 512;    //每个响应头（含校验器和Content-Range）或错误页的最大长度，生成前在写缓冲区链中预留这么多连续空间
+    static const int MAX_IOV = 64;              //一次writev最多使用的iovec数
+    static const int MAX_RANGES = 16;           //一个Range请求最多的区间数，超过时发送整个文件
     /*
     本项目实际使用的只有GET
     HTTP/1.1支持以下9种method
@@ -56,10 +72,16 @@ public:
     NO_RESOURCE: 请求的资源不存在
     FORBIDDEN_REQUEST：没有权限访问请求的资源
     FILE_REQUEST: 请求的资源是文件且可正常访问
+    NOT_MODIFIED: 条件请求的校验器匹配，回复304
+    PARTIAL_CONTENT: 请求文件的部分区间，回复206
+    RANGE_NOT_SATISFIABLE: 请求的区间都超出文件，回复416
+    STATS_REQUEST: 请求的是运行指标（/__stats）
+    FILE_PENDING: 目标文件要从磁盘加载，请求交给I/O线程池，加载完后从do_request()继续
     INTERNAL_ERRORl: 服务器内部错误
     CLOSED_CONNECTION: 申请的http连接已关闭
     */
-    enum HTTP_CODE {NO_REQUEST = 0, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION};
+    enum HTTP_CODE {NO_REQUEST = 0, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, STATS_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION,
+                    NOT_MODIFIED, PARTIAL_CONTENT, RANGE_NOT_SATISFIABLE, FILE_PENDING};
     /* 
     从状态机（当前行的读取状态）可能有以下三种状态:
     LINE_OK: 完整读取了一行
@@ -67,52 +89,111 @@ public:
     LINE_OPEN: 读取的行不完整
     */
 	enum LINE_STATUS {LINE_OK = 0, LINE_BAD, LINE_OPEN};
+    /*
+    连接当前使用的超时类型：
+    TIMER_IDLE: keep-alive连接在等待下一个请求
+    TIMER_HEADER: 正在读取一个请求
+    TIMER_WRITE: 正在等待socket可写以发送响应
+    */
+    enum TIMER_KIND {TIMER_IDLE = 0, TIMER_HEADER, TIMER_WRITE};
 
-    http_conn(){}
+    http_conn() : m_timer_kind( TIMER_IDLE ), m_dispatched( 0 ), m_processed( 0 ), m_enqueue_ns( 0 ), m_read_ns( 0 ), m_buffers( NULL ), m_read_buf( NULL ), m_read_size( 0 ), m_file( NULL ), m_resp_head( 0 ), m_resp_count( 0 ){}
     ~http_conn(){}
 
-    void init(int sockfd, const sockaddr_in& addr); //初始化套接字地址，函数内部会调用私有方法init
-    void close_conn(); //关闭http连接
+    void init(int sockfd, const sockaddr_in& addr, int epollfd, buffer_pool* buffers, bool edge = false); //初始化套接字地址并记录所属反应堆的epoll和缓冲区池，edge表示以边沿触发注册，函数内部会调用私有方法init
+    void close_conn(); //关闭http连接，归还缓冲区
+    void release_buffers(); //连接空闲时归还读写缓冲区，读缓冲区中还有未处理的数据时保留
     void process(); //主从状态机 报文解析（处理客户端请求）
     bool read(); //读取浏览器端发来的全部数据 非阻塞读
+    int fill(const char* data, int len); //io_uring引擎把已收到的数据拷入读缓冲区，代替read()
     bool write(); //响应报文写入函数 非阻塞写
+    bool parse_pending() const {return m_parse_pending;} //响应队列已满时未解析完的流水线请求，发送完后需要再次process
+    bool writing() const {return m_resp_head < m_resp_count;} //还有响应在等待socket可写
 
 private:
     void init(); // 初始化连接
+    void rearm(int ev); // 单次触发模式下重新注册读或写事件
+    bool process_requests(); // 解析缓冲区中的请求并生成响应，返回true表示连接已交给I/O线程池
+    void load_file(); // 阻塞地从文件缓存（必要时从磁盘）取得目标文件，由I/O线程调用
+    bool busy() const {return m_dispatched.load(std::memory_order_relaxed) != m_processed.load(std::memory_order_acquire);}
+    bool input_pending() const;                 //socket中有还没读入的数据（不取走）
+    bool acquire_buffers(); // 从缓冲区池借用读缓冲区，已持有时什么也不做
+    void init_request(); // 一个请求处理完毕，重置解析状态以解析同一缓冲区中的下一个请求
+    bool make_room(); // 读缓冲区满时腾出空间：先丢弃已处理完的请求，仍然满则加倍，达到上限时返回false
+    void compact(); // 把未处理完的数据移到读缓冲区开头
+    void rebase(const char* old_base, int shift); // 读缓冲区搬移后平移已解析出的指针
     HTTP_CODE process_read(); //从read_buf读取，并处理请求报文
-    bool process_write(HTTP_CODE ret); //向write_buf写入响应报文数据
+    bool process_write(HTTP_CODE ret); //向写缓冲区链写入响应报文数据
+    bool write_responses(); //write()的实现，write()在外面统计耗时
+    bool sending_file() const; //第一个响应的头已发完，接下来用sendfile发送大文件的内容
+    ssize_t send_file(); //用sendfile发送第一个响应剩余的文件内容
+    int gather(struct iovec* iv, bool* more); //把排队响应中在内存里的部分填入iv，返回iovec数；more表示随后还要sendfile
+    bool advance(size_t sent); //按已发送的字节数推进响应队列，返回false表示应关闭连接
+    void log_request(int status, uint64_t bytes); //记录一条访问日志
 
     HTTP_CODE parse_request_line(char* text); //主状态机解析报文中的请求行数据
     HTTP_CODE parse_headers(char* text); //主状态机解析报文中的请求头数据
     HTTP_CODE parse_content(char* text); //主状态机解析报文中的请求体数据
     HTTP_CODE do_request(); //生成响应报文
+    HTTP_CODE check_conditions(); //按If-None-Match/If-Modified-Since/Range/If-Range决定回复200、304、206还是416
     char* get_line() {return m_read_buf + m_start_line;} //get_line用于将指针向后偏移，指向未处理的字符
     LINE_STATUS parse_line(); //读取一行，分析是请求报文的哪一部分
+    void set_line_end(int cr_idx); //记录当前行的字符串结束位置
 
-    void unmap();  //封装munmap
-    //根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
-    bool add_response(const char* format, ...);
-    bool add_content(const char* content);
-    bool add_content_type();
-    bool add_status_line(int status, const char* title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
-    bool add_linger();
-    bool add_blank_line();
+    void close_file();  //归还所有排队响应引用的文件缓存条目
+    //以下函数由process_write调用，用编译期生成的片段和数字拼出响应头，只做memcpy
+    bool add_bytes(const char* data, size_t len);
+    template< size_t N >
+    bool add_bytes(const const_bytes< N >& bytes) {return add_bytes(bytes.data, N);} //编译期生成的片段
+    bool add_number(uint64_t value); //十进制整数
+    bool add_content_length(off_t content_length);
+    bool add_linger(); //Connection字段和结束头部的空行
+    bool add_error(const char* head, size_t head_len, const char* form, size_t form_len); //预先生成的错误响应头加错误页
+    bool add_file_fields(); //缓存预生成的Content-Type之后的字段：编码、校验器等
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    static std::atomic<int> m_user_count; // 各反应堆线程共享的客户总数
+    static file_cache* m_file_cache;      // 所有连接共享的文件缓存
+    static int m_max_request_size;        // 读缓冲区大小的上限，请求头超过它时关闭连接
+    static const char* m_doc_root;        // 网站根目录，不以/结尾
+    static const pool_stats* m_pool_stats;// 线程池模式下线程池的状态，输出到/__stats
+    static std::atomic<bool> m_draining;  // 服务器正在停止：之后的响应都带Connection: close，发完即关闭连接
+    static io_pool* m_io_pool;            // 加载冷文件的I/O线程池，为NULL时在处理请求的线程中就地加载
+    static size_t m_readahead;            // I/O线程为大文件预读的字节数
 
 private:
+    friend class reactor;
+    friend class uring_reactor;
+    friend struct io_task;
+    // 以下三个成员只由所属反应堆线程读写
+    timer_node m_timer; // 超时定时器，挂在所属反应堆的时间轮上
+    TIMER_KIND m_timer_kind;
+    timer_node m_ready; // 边沿触发模式下本轮读取预算用完、socket中可能还有数据时挂在反应堆的就绪链表上；
+                        // 线程池模式下事件到达时工作线程还没记下处理到的序号，也挂在这里等待
+    uint32_t m_deferred_events; // 线程池模式下挂在就绪链表上时推迟处理的epoll事件
+    // 反应堆每交给线程池（或就地）处理一次加1，process()在最后一次访问连接之后记下处理到的序号，
+    // 二者不等说明还有工作线程在处理该连接，反应堆不能关闭它
+    std::atomic<unsigned> m_dispatched;
+    std::atomic<unsigned> m_processed;
+    uint64_t m_enqueue_ns;  // 交给线程池的时刻，用于统计排队时间，就地处理时为0
+    uint64_t m_read_ns;     // 最近一次读到数据的时刻，访问日志中的耗时从这里算起
+    unsigned m_home;        // 交给线程池时的亲和键：默认是fd，绑定CPU时是处理该连接数据包的CPU所在节点上的工作线程
+
+    int m_epollfd; // 连接所属反应堆的epoll实例，连接的所有事件都注册在这里
+    bool m_edge; // 以边沿触发注册，读写都要进行到EAGAIN，不再逐次重新注册
     int m_sockfd;
     sockaddr_in m_address;
-    char m_read_buf[READ_BUFFER_SIZE]; // 读缓冲区
+    buffer_pool* m_buffers; // 所属反应堆的缓冲区池，读写缓冲区只在处理请求期间借用
+    char* m_read_buf; // 读缓冲区，空闲时为NULL
+    int m_read_size; // 读缓冲区当前的大小
     int m_read_idx; //标识读缓冲区中已经读入数据的字节数
+    bool m_read_blocked; //上次read()读到了EAGAIN，边沿触发时要等新的EPOLLIN才有数据
     int m_checked_idx; //当前正在分析的字符在读缓冲区中的位置
     int m_start_line; //当前正在解析的行的起始位置
-    char m_write_buf[WRITE_BUFFER_SIZE]; //写缓冲区
-    int m_write_idx; // 写缓冲区中待发送的字节数
+    char* m_line_end; //当前行的字符串结束位置，解析函数在[行首, m_line_end)内做向量化查找
+    int m_request_start; //当前请求在读缓冲区中的起始位置，之前的数据都已处理完
+    bool m_parse_pending; //因响应队列满而暂停解析
+    buffer_chain m_write_chain; //写缓冲区链，存放排队响应的响应头，空闲时不占缓冲区
 
 	
     CHECK_STATE m_check_state; //主状态机的状态
@@ -124,16 +205,57 @@ private:
     char* m_version;
     char* m_host;
     int m_content_length;
+    int m_accept_encoding; //客户端接受的内容编码，1 << CONTENT_ENCODING的位集合
+    char* m_if_none_match;
+    char* m_if_modified_since;
+    char* m_range;
+    char* m_if_range;
     bool m_linger; //是否保持连接
 
 	
-    char* m_file_address;       //客户请求的目标文件被mmap到内存中的起始位置
+    file_entry* m_file;         //当前请求的目标文件在缓存中的条目，生成响应后转交给响应队列
     struct stat m_file_stat;    //对应文件的filestat
-    struct iovec m_iv[2];       //io向量机制iovec
-    int m_iv_count;             // m_iv_count表示被写内存块的数量
-    
-    int bytes_to_send;                  // 将要发送的数据的字节数
-    int bytes_have_send;                // 已经发送的字节数
+    io_task m_io_task;          //交给I/O线程池的任务，done由所属反应堆设置
+    bool m_file_pending;        //当前请求在等待（或已完成）I/O线程的加载，process_requests()从do_request()继续
+    file_cache::STATUS m_file_status; //I/O线程取得目标文件的结果
+    byte_range m_ranges[MAX_RANGES]; //206响应要发送的区间
+    int m_range_count;
+
+    /*
+    流水线响应队列：一次读入的多个请求依次生成响应，响应头都放在写缓冲区链中，
+    发送时把多个响应的头部和内存中的文件内容拼成一次writev；大文件的内容单独用sendfile发送
+    响应体由若干片段依次组成：整个文件、文件的一个区间，或multipart/byteranges中交替的分隔头和文件区间
+    */
+    struct chunk
+    {
+        const char* data;       //内存中的数据，为NULL时是文件fd上从offset开始的内容，用sendfile发送
+        off_t offset;
+        off_t len;
+    };
+    struct response
+    {
+        const char* head;       //响应头在写缓冲区链中的位置
+        int head_len;           //响应头（及错误页内容）的长度
+        file_entry* file;       //响应体所在的缓存条目，没有响应体时为NULL，发送完毕后归还
+        char* body;             //动态生成的响应体（/__stats或multipart的分隔头），发送完毕后释放
+        off_t body_len;         //响应体长度，各片段长度之和
+        chunk one;              //只有一个片段时使用
+        chunk* chunks;          //多个片段时malloc，发送完毕后释放；为NULL时使用one
+        int chunk_count;
+        size_t sent;            //本响应已发送的字节数，64位计数，文件超过2GiB时不会溢出
+        bool linger;            //发送完后是否保持连接
+
+        const chunk* body_chunks() const {return chunks ? chunks : &one;}
+    };
+    const chunk* find_chunk(const response& r, off_t* skip) const; //r接下来要发送的片段，skip为片段中已发送的字节数
+    bool add_ranges(chunk** chunks, off_t* body_len); //206响应的头部，多个区间时生成multipart的片段表
+    response m_responses[MAX_PIPELINE];
+    int m_resp_head;            //第一个未发送完的响应
+    int m_resp_count;           //队列中的响应数
+    char* m_response_start;     //正在生成的响应在写缓冲区链中的起始位置
+
+    size_t bytes_to_send;               // 队列中将要发送的数据的字节数
+    size_t bytes_have_send;             // 本批响应已经发送的字节数
     
 };
 
@@ -0,0 +1,277 @@
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PARSER_X86 1
+#endif
+
+#include "http_parser.h"
+
+typedef const char* (*find_char2_fn)(const char*, const char*, char, char);
+
+static const char* find_char2_scalar(const char* p, const char* end, char a, char b){
+    for( ; p < end; ++p ){
+        if( *p == a || *p == b ){
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef PARSER_X86
+// SSE4.2：pcmpestri一次比较16字节与字符集合{a, b}
+__attribute__((target("sse4.2")))
+static const char* find_char2_sse42(const char* p, const char* end, char a, char b){
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for( ; p + 16 <= end; p += 16 ){
+        __m128i v = _mm_loadu_si128( ( const __m128i* )p );
+        int idx = _mm_cmpestri( set, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT );
+        if( idx != 16 ){
+            return p + idx;
+        }
+    }
+    return find_char2_scalar( p, end, a, b );
+}
+
+// AVX2：一次比较32字节，两次相等比较合并后取掩码的最低位
+__attribute__((target("avx2")))
+static const char* find_char2_avx2(const char* p, const char* end, char a, char b){
+    const __m256i va = _mm256_set1_epi8( a );
+    const __m256i vb = _mm256_set1_epi8( b );
+    for( ; p + 32 <= end; p += 32 ){
+        __m256i v = _mm256_loadu_si256( ( const __m256i* )p );
+        unsigned mask = _mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpeq_epi8( v, va ), _mm256_cmpeq_epi8( v, vb ) ) );
+        if( mask ){
+            return p + __builtin_ctz( mask );
+        }
+    }
+    return find_char2_sse42( p, end, a, b );
+}
+#endif
+
+static find_char2_fn resolve_find_char2( const char** level ){
+#ifdef PARSER_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "avx2" ) ){
+        *level = "avx2";
+        return find_char2_avx2;
+    }
+    if( __builtin_cpu_supports( "sse4.2" ) ){
+        *level = "sse4.2";
+        return find_char2_sse42;
+    }
+#endif
+    *level = "scalar";
+    return find_char2_scalar;
+}
+
+static const char* simd_level = "scalar";
+static const find_char2_fn find_char2_impl = resolve_find_char2( &simd_level );
+
+const char* find_char2(const char* begin, const char* end, char a, char b){
+    return find_char2_impl( begin, end, a, b );
+}
+
+const char* parser_simd_level(){
+    return simd_level;
+}
+
+/*
+头部字段名的完美哈希：槽位 = (长度 * 5 + 小写首字符) % 32
+哈希表在编译期生成，新增字段名产生冲突时static_assert会报错
+*/
+struct header_def
+{
+    const char* name;
+    int len;
+    HEADER_ID id;
+};
+
+static constexpr header_def known_headers[] = {
+    {"", 0, HEADER_UNKNOWN},
+    {"connection", 10, HEADER_CONNECTION},
+    {"content-length", 14, HEADER_CONTENT_LENGTH},
+    {"host", 4, HEADER_HOST},
+    {"accept-encoding", 15, HEADER_ACCEPT_ENCODING},
+    {"if-none-match", 13, HEADER_IF_NONE_MATCH},
+    {"if-modified-since", 17, HEADER_IF_MODIFIED_SINCE},
+    {"range", 5, HEADER_RANGE},
+    {"if-range", 8, HEADER_IF_RANGE},
+};
+static constexpr int KNOWN_HEADER_NUMBER = sizeof( known_headers ) / sizeof( known_headers[0] );
+static constexpr unsigned HEADER_TABLE_SIZE = 32;
+
+static constexpr unsigned header_hash( int len, char first ){
+    return ( len * 5u + ( unsigned char )( first | 0x20 ) ) % HEADER_TABLE_SIZE;
+}
+
+struct header_table
+{
+    unsigned char slot[HEADER_TABLE_SIZE]; //known_headers的下标，0表示空
+};
+
+static constexpr header_table build_header_table(){
+    header_table table = {};
+    for( int i = 1; i < KNOWN_HEADER_NUMBER; i++ ){
+        table.slot[ header_hash( known_headers[i].len, known_headers[i].name[0] ) ] = i;
+    }
+    return table;
+}
+
+static constexpr bool header_table_is_perfect(){
+    header_table table = build_header_table();
+    for( int i = 1; i < KNOWN_HEADER_NUMBER; i++ ){
+        if( table.slot[ header_hash( known_headers[i].len, known_headers[i].name[0] ) ] != i ){
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert( header_table_is_perfect(), "header name hash has a collision, adjust header_hash" );
+static constexpr header_table header_slots = build_header_table();
+
+HEADER_ID lookup_header(const char* name, int len){
+    if( len <= 0 ){
+        return HEADER_UNKNOWN;
+    }
+    const header_def& def = known_headers[ header_slots.slot[ header_hash( len, name[0] ) ] ];
+    // 槽位唯一确定候选字段，只需一次不区分大小写的比较确认
+    if( def.len == len && strncasecmp( name, def.name, len ) == 0 ){
+        return def.id;
+    }
+    return HEADER_UNKNOWN;
+}
+
+// 解析非负十进制数，没有数字或溢出时返回false
+static bool parse_offset( const char*& p, off_t* value ){
+    if( *p < '0' || *p > '9' ){
+        return false;
+    }
+    off_t v = 0;
+    for( ; *p >= '0' && *p <= '9'; ++p ){
+        if( v > ( LLONG_MAX - 9 ) / 10 ){
+            return false;
+        }
+        v = v * 10 + ( *p - '0' );
+    }
+    *value = v;
+    return true;
+}
+
+int parse_byte_ranges( const char* value, off_t size, byte_range* ranges, int max ){
+    value += strspn( value, " \t" );
+    if( strncasecmp( value, "bytes=", 6 ) != 0 ){
+        return -1;
+    }
+    const char* p = value + 6;
+    int count = 0;
+    while( true ){
+        p += strspn( p, " \t," );
+        if( *p == '\0' ){
+            break;
+        }
+        off_t start, end;
+        if( *p == '-' ){
+            // 后缀区间：最后n个字节
+            off_t n;
+            ++p;
+            if( !parse_offset( p, &n ) ){
+                return -1;
+            }
+            start = n < size ? size - n : 0;
+            end = size - 1;
+            if( n == 0 ){
+                start = size;   //不可满足
+            }
+        }
+        else{
+            if( !parse_offset( p, &start ) || *p != '-' ){
+                return -1;
+            }
+            ++p;
+            if( *p >= '0' && *p <= '9' ){
+                if( !parse_offset( p, &end ) || end < start ){
+                    return -1;
+                }
+                if( end >= size ){
+                    end = size - 1;
+                }
+            }
+            else{
+                end = size - 1;
+            }
+        }
+        p += strspn( p, " \t" );
+        if( *p != ',' && *p != '\0' ){
+            return -1;
+        }
+        if( start >= size ){
+            continue;   //起点超出文件的区间忽略，全部不可满足时回复416
+        }
+        if( count == max ){
+            return -1;
+        }
+        ranges[count].start = start;
+        ranges[count].end = end;
+        count++;
+    }
+    // 按起点排序（最多max个，插入排序），合并重叠或相邻的区间，重复的区间不会让同一段内容发送多次
+    for( int i = 1; i < count; i++ ){
+        byte_range r = ranges[i];
+        int j = i;
+        for( ; j > 0 && ranges[j - 1].start > r.start; j-- ){
+            ranges[j] = ranges[j - 1];
+        }
+        ranges[j] = r;
+    }
+    int merged = 0;
+    for( int i = 0; i < count; i++ ){
+        if( merged > 0 && ranges[i].start <= ranges[merged - 1].end + 1 ){
+            if( ranges[i].end > ranges[merged - 1].end ){
+                ranges[merged - 1].end = ranges[i].end;
+            }
+        }
+        else{
+            ranges[merged++] = ranges[i];
+        }
+    }
+    return merged;
+}
+
+bool parse_http_date( const char* value, time_t* t ){
+    struct tm tm;
+    memset( &tm, 0, sizeof( tm ) );
+    value += strspn( value, " \t" );
+    const char* end = strptime( value, "%a, %d %b %Y %H:%M:%S GMT", &tm );
+    if( !end ){
+        return false;
+    }
+    *t = timegm( &tm );
+    return true;
+}
+
+bool etag_list_matches( const char* list, const char* etag ){
+    size_t etag_len = strlen( etag );
+    const char* p = list;
+    while( true ){
+        p += strspn( p, " \t," );
+        if( *p == '\0' ){
+            return false;
+        }
+        if( *p == '*' ){
+            return true;
+        }
+        // 弱比较：忽略W/前缀
+        if( ( p[0] == 'W' || p[0] == 'w' ) && p[1] == '/' ){
+            p += 2;
+        }
+        size_t len = strcspn( p, " \t," );
+        if( len == etag_len && memcmp( p, etag, len ) == 0 ){
+            return true;
+        }
+        p += len;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <time.h>
+#include <sys/types.h>
+
+/*
+HTTP报文解析的向量化基础操作
+按运行时CPUID选择AVX2（一次32字节）、SSE4.2（一次16字节）或逐字节的实现，
+http_conn用它们查找行结束符、请求行中的空白分隔符以及头部字段名后的冒号。
+*/
+
+// 在[begin, end)中查找第一个等于a或b的字节，找不到时返回end
+const char* find_char2(const char* begin, const char* end, char a, char b);
+
+// 当前使用的实现："avx2"、"sse4.2"或"scalar"
+const char* parser_simd_level();
+
+// 已知的请求头部字段
+enum HEADER_ID {HEADER_UNKNOWN = 0, HEADER_CONNECTION, HEADER_CONTENT_LENGTH, HEADER_HOST, HEADER_ACCEPT_ENCODING,
+               HEADER_IF_NONE_MATCH, HEADER_IF_MODIFIED_SINCE, HEADER_RANGE, HEADER_IF_RANGE};
+
+// 按长度和首字符的完美哈希识别头部字段名（不区分大小写），name不含冒号
+HEADER_ID lookup_header(const char* name, int len);
+
+// Range中的一个区间，[start, end]闭区间，与Content-Range的写法一致
+struct byte_range
+{
+    off_t start;
+    off_t end;
+};
+
+// 解析"bytes=a-b, c-, -n"，按大小为size的文件截断，按起点排序并合并重叠或相邻的区间后写入ranges；
+// 返回可满足的区间数，0表示都不可满足（应回复416），-1表示语法错误或区间多于max（应忽略Range）
+int parse_byte_ranges(const char* value, off_t size, byte_range* ranges, int max);
+
+// 解析IMF-fixdate格式的HTTP日期，如"Sun, 06 Nov 1994 08:49:37 GMT"
+bool parse_http_date(const char* value, time_t* t);
+
+// If-None-Match的列表中是否有与etag弱比较相等的项，"*"匹配任何存在的资源
+bool etag_list_matches(const char* list, const char* etag);
+
+#endif
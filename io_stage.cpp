@@ -0,0 +1,45 @@
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "io_stage.h"
+#include "http_conn.h"
+
+void io_task::process(){
+    conn->load_file();
+    done->push( conn );
+}
+
+io_completions::io_completions(){
+    // 升级时fork出的新进程不能继承
+    m_eventfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( m_eventfd == -1 ){
+        throw std::exception();
+    }
+}
+
+io_completions::~io_completions(){
+    close( m_eventfd );
+}
+
+void io_completions::push( http_conn* conn ){
+    // 在锁内写eventfd：反应堆取走最后一个连接后可能立即退出并销毁本对象
+    m_lock.lock();
+    bool wake = m_conns.empty();
+    m_conns.push_back( conn );
+    if( wake ){
+        uint64_t one = 1;
+        ssize_t n = write( m_eventfd, &one, sizeof( one ) );
+        ( void )n;
+    }
+    m_lock.unlock();
+}
+
+void io_completions::take( std::vector< http_conn* >& out ){
+    uint64_t count;
+    ssize_t n = read( m_eventfd, &count, sizeof( count ) );
+    ( void )n;
+    m_lock.lock();
+    out.swap( m_conns );
+    m_lock.unlock();
+}
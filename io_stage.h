@@ -0,0 +1,46 @@
+#ifndef IO_STAGE_H
+#define IO_STAGE_H
+
+#include <vector>
+
+#include "locker.h"
+#include "threadpool.h"
+
+class http_conn;
+class io_completions;
+
+/*
+异步I/O阶段：目标文件不在缓存中、到了重新stat的时间或第一次协商某个编码时，请求不在反应堆或工作线程中阻塞地
+stat/open/读文件，而是交给专门的I/O线程池。I/O线程把文件加载进缓存（大文件用readahead把要发送的开头读进页缓存），
+完成后把连接放进所属反应堆的完成队列并用eventfd唤醒它，反应堆重新分派该连接，从do_request()继续。
+等待期间连接算作忙碌（m_dispatched != m_processed），反应堆不会关闭它；命中缓存的请求不会排在冷文件后面等磁盘。
+io_uring引擎不使用I/O阶段，仍然就地加载。
+*/
+
+// 连接上等待磁盘的请求，嵌在http_conn中，由I/O线程池执行
+struct io_task
+{
+    http_conn* conn;
+    io_completions* done;       //所属反应堆的完成队列，为NULL时就地加载
+    void process();
+};
+
+// I/O线程池，复用线程池的实现，线程数固定、不绑定CPU
+typedef threadpool< io_task > io_pool;
+
+// 反应堆的完成队列：I/O线程放入加载完的连接，反应堆在eventfd可读时取出
+class io_completions
+{
+public:
+    io_completions();
+    ~io_completions();
+    int fd() const {return m_eventfd;}
+    void push(http_conn* conn);                 //I/O线程调用，之后不再访问conn
+    void take(std::vector< http_conn* >& out);  //所属反应堆调用，取出全部
+private:
+    locker m_lock;
+    std::vector< http_conn* > m_conns;
+    int m_eventfd;
+};
+
+#endif
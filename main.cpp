@@ -9,16 +9,33 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "reactor.h"
+#include "http_parser.h"
+#include "access_log.h"
+#include "mime.h"
+#include "handoff.h"
+#include "topology.h"
+#include "config.h"
+#ifdef IO_URING
+#include "uring_reactor.h"
+#endif
 
-#define MAX_FD 65536                //最大文件描述符数量
-#define MAX_EVENT_NUMBER 10000      //最大监听事件数量
+// make DEFER_ACCEPT=秒数：数据到达后才完成accept；make FASTOPEN=队列长度：允许TCP Fast Open；0表示不开启
+#ifndef LISTEN_DEFER_ACCEPT_S
+#define LISTEN_DEFER_ACCEPT_S 0
+#endif
+#ifndef LISTEN_FASTOPEN_QLEN
+#define LISTEN_FASTOPEN_QLEN 0
+#endif
 
-extern int addfd( int epollfd, int fd, bool one_shot );
-extern int removefd( int epollfd, int fd );
+extern int setnonblocking( int fd );
 
 // handler回调函数，用来处理信号
 void addsig( int sig, void( handler )(int), bool restart = true )
@@ -34,137 +51,326 @@ void addsig( int sig, void( handler )(int), bool restart = true )
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
 
-void show_error( int connfd, const char* info )
+// 创建监听socket，多反应堆模式下开启SO_REUSEPORT，由内核在各监听socket间分发连接
+// 监听socket非阻塞，反应堆每次可读时连续accept直到EAGAIN或用完预算
+int create_listenfd( const char* ip, int port, bool reuse_port, int backlog )
 {
-    printf( "%s", info );
-    send( connfd, info, strlen( info ), 0 );
-    close( connfd );
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert( listenfd >= 0 );
+
+    // struct linger tmp = { 1, 0 };
+    // setsockopt( listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof( tmp ) );
+
+    int ret = 0;
+    struct sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    inet_pton( AF_INET, ip, &address.sin_addr ); // 0.0.0.0(INADDR_ANY)泛指本机的所有IP(因为有些机器有多张网卡)，已由resolve_config校验
+    address.sin_port = htons( port );
+
+    // 端口复用
+    int reuse=1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)); 
+    if( reuse_port )
+    {
+        ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+        assert( ret >= 0 );
+    }
+
+    ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
+    assert( ret >= 0 );
+
+    // 可选特性，内核不支持时只打印提示
+    int defer = LISTEN_DEFER_ACCEPT_S;
+    if( defer > 0 && setsockopt( listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof( defer ) ) < 0 )
+    {
+        printf( "TCP_DEFER_ACCEPT not supported, errno is: %d\n", errno );
+    }
+    int fastopen = LISTEN_FASTOPEN_QLEN;
+    if( fastopen > 0 && setsockopt( listenfd, IPPROTO_TCP, TCP_FASTOPEN, &fastopen, sizeof( fastopen ) ) < 0 )
+    {
+        printf( "TCP_FASTOPEN not supported, errno is: %d\n", errno );
+    }
+
+    ret = listen( listenfd, backlog );
+    assert( ret >= 0 );
+    return listenfd;
 }
 
+// 主线程等待停止信号：SIGTERM/SIGINT直接返回；SIGUSR2先启动新进程并交出监听socket，成功后返回，失败时继续服务
+static void wait_for_stop( const sigset_t& signals, char* argv[], const int* listenfds, int count )
+{
+    while( true )
+    {
+        int sig = 0;
+        if( sigwait( &signals, &sig ) != 0 )
+        {
+            continue;
+        }
+        if( sig == SIGUSR2 )
+        {
+            printf( "upgrading to %s\n", argv[0] );
+            if( !handoff_start( argv, listenfds, count ) )
+            {
+                continue;
+            }
+        }
+        printf( "draining connections\n" );
+        return;
+    }
+}
 
-int main( int argc, char* argv[] )
+// 所有反应堆各自运行在独立线程中，主线程等待停止信号，之后通知各反应堆排空连接，返回时所有反应堆都已退出
+template< typename R >
+bool run_reactors( R** reactors, int count, const sigset_t& signals, char* argv[], const int* listenfds, int handoff_channel )
 {
-    if( argc <= 2 )
+    int started = 0;
+    for( ; started < count; started++ )
     {
-        printf( "usage: %s ip_address port_number\n", basename( argv[0] ) );
-        return 1;
+        if( !reactors[started]->start() )
+        {
+            printf( "failed to start reactor %d\n", started );
+            break;
+        }
     }
-    const char* ip = argv[1];
-    int port = atoi( argv[2] );
-	
-	/*忽略SIGPIPE信号*/
-    addsig( SIGPIPE, SIG_IGN );
+    if( started == count )
+    {
+        handoff_ready( handoff_channel ); // 由旧进程启动时，通知它可以排空退出
+        wait_for_stop( signals, argv, listenfds, count );
+    }
+    http_conn::m_draining.store( true );
+    for( int i = 0; i < started; i++ )
+    {
+        reactors[i]->stop();
+    }
+    for( int i = 0; i < started; i++ )
+    {
+        reactors[i]->join();
+    }
+    return started == count;
+}
 
-    // 创建线程池
-    threadpool< http_conn >* pool = NULL;
+// 在cpu所在节点上构造反应堆：主线程临时绑定到cpu，构造函数分配的连接对象、缓冲区等首次访问时落在该节点
+template< typename R, typename F >
+R* create_on_cpu( int cpu, F create )
+{
+    cpu_set_t old_set;
+    bool pinned = cpu >= 0 && pin_current_thread( cpu, &old_set );
+    R* r = NULL;
     try
     {
-        pool = new threadpool<http_conn>;
+        r = create();
     }
     catch( ... )
     {
-        return 1;
     }
+    if( pinned )
+    {
+        pthread_setaffinity_np( pthread_self(), sizeof( old_set ), &old_set );
+    }
+    if( r && cpu >= 0 )
+    {
+        r->set_cpu( cpu );
+    }
+    return r;
+}
 
-	// 预先为每个可能的用户连接分配一个http_conn对象
-    http_conn* users = new http_conn[ MAX_FD ];
-    assert(users);
-    int user_count = 0;
 
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert( listenfd >= 0 );
+int main( int argc, char* argv[] )
+{
+    // 默认值 < 配置文件 < 命令行，见config.h
+    server_config config;
+    if( argc <= 1 || !parse_command_line( &config, argc, argv ) )
+    {
+        printf( "usage: %s [-c config_file] [--key=value...] ip_address port_number [reactor_number] [max_request_kb] [backlog] [cpus]\n", basename( argv[0] ) );
+        return 1;
+    }
+    // 线程绑定的CPU：none不绑定（默认），auto为进程允许运行的所有CPU，也可以是列表如"0-3,8"
+    static cpu_topology topo;
+    bool placed = strcmp( config.cpus, "none" ) != 0;
+    if( placed && !load_topology( config.cpus, &topo ) )
+    {
+        printf( "invalid cpu list %s\n", config.cpus );
+        return 1;
+    }
+    // auto的反应堆数和工作线程数取参与放置的CPU数，不绑定时取进程允许运行的CPU数
+    cpu_set_t allowed;
+    CPU_ZERO( &allowed );
+    sched_getaffinity( 0, sizeof( allowed ), &allowed );
+    if( !resolve_config( &config, placed ? topo.cpu_count : CPU_COUNT( &allowed ) ) )
+    {
+        return 1;
+    }
+    print_config( config );
+    if( placed )
+    {
+        printf( "topology: %d nodes, %d cpus\n", topo.node_count, topo.cpu_count );
+    }
+    // 反应堆数量：0表示单反应堆+线程池，N>0表示N个各自独立处理连接的反应堆线程
+    int reactor_number = config.reactors;
+    http_conn::m_max_request_size = config.max_request_kb * 1024;
+    http_conn::m_doc_root = config.doc_root;
 
-    // struct linger tmp = { 1, 0 };
-    // setsockopt( listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof( tmp ) );
+    printf( "http parser: %s\n", parser_simd_level() );
 
-    int ret = 0;
-    struct sockaddr_in address;
-    address.sin_addr.s_addr = INADDR_ANY; // INADDR_ANY转换过来是0.0.0.0→泛指本机,表示本机的所有IP(因为有些机器有多张网卡)
-    address.sin_family = AF_INET;
-    //inet_pton( AF_INET, ip, &address.sin_addr );
-    address.sin_port = htons( port );
+    // 在启动工作线程之前载入，之后只读
+    int mime_count = load_mime_types( config.mime_types );
+    if( mime_count >= 0 ){
+        printf( "mime types: %d extensions from %s\n", mime_count, config.mime_types );
+    }
 
-    // 端口复用
-    int reuse=1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)); 
+	/*忽略SIGPIPE信号*/
+    addsig( SIGPIPE, SIG_IGN );
 
-    ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
-    assert( ret >= 0 );
+    // 停止和升级信号在创建任何线程之前屏蔽，所有线程继承，只由主线程sigwait同步处理
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGTERM );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGUSR2 );
+    pthread_sigmask( SIG_BLOCK, &signals, NULL );
 
-    ret = listen( listenfd, 5 );
-    assert( ret >= 0 );
+    // io_uring引擎总是在反应堆线程内就地处理请求，内核不支持时退回epoll
+    bool use_uring = false;
+#ifdef IO_URING
+    use_uring = uring_reactor::supported();
+    printf( "event engine: %s\n", use_uring ? "io_uring" : "epoll (io_uring not supported by the kernel)" );
+#endif
 
-    // 创建epoll对象和事件数组，并将监听的事件添加epoll中
-    epoll_event events[ MAX_EVENT_NUMBER ];
-    int epollfd = epoll_create( 5 );
-    assert( epollfd != -1 );
-    addfd( epollfd, listenfd, false );
-    http_conn::m_epollfd = epollfd;
+    // 创建线程池，多反应堆模式下请求在反应堆线程内就地处理，不需要线程池
+    http_pool* pool = NULL;
+    static worker_steering steering;
+    if( reactor_number == 0 && !use_uring )
+    {
+        try
+        {
+            pool = new http_pool( config.workers, config.queue_depth, placed ? topo.order : NULL, placed ? topo.cpu_count : 0,
+                                  config.pool_max_workers, config.pool_target_wait_ms );
+            http_conn::m_pool_stats = &pool->stats();
+        }
+        catch( ... )
+        {
+            return 1;
+        }
+    }
 
-    // 循环处理epoll返回的事件
-    while( true )
+    // 创建所有连接共享的文件缓存，以及把冷文件从磁盘加载进缓存的I/O线程池（io_uring引擎就地加载）
+    try
     {
-        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, -1 );
-        if ( ( number < 0 ) && ( errno != EINTR ) )
+        http_conn::m_file_cache = new file_cache( ( size_t )config.cache_mb << 20, ( size_t )config.cache_max_file_kb << 10,
+                                                  config.cache_entries, config.cache_revalidate_ms );
+        if( config.io_threads > 0 && !use_uring )
         {
-            printf( "epoll failure\n" );
-            break;
+            http_conn::m_io_pool = new io_pool( config.io_threads, config.io_queue_depth );
+            http_conn::m_readahead = ( size_t )config.io_readahead_kb << 10;
         }
+    }
+    catch( ... )
+    {
+        return 1;
+    }
 
-        for ( int i = 0; i < number; i++ )
+    // 启动异步访问日志，未配置或打不开日志文件时不记录
+    if( config.access_log[0] && !access_log::start( config.access_log ) )
+    {
+        printf( "failed to open access log %s\n", config.access_log );
+    }
+
+    int count = reactor_number > 0 ? reactor_number : 1;
+    int* listenfds = new int[ count ];
+    // 升级启动时沿用旧进程的监听socket，不足的部分（反应堆变多时，要求旧进程也开启了SO_REUSEPORT）再创建
+    int handoff_channel = -1;
+    int inherited = handoff_receive( listenfds, count, &handoff_channel );
+    if( handoff_channel >= 0 )
+    {
+        printf( "inherited %d listening sockets\n", inherited );
+    }
+    for( int i = 0; i < inherited; i++ )
+    {
+        setnonblocking( listenfds[i] ); // 旧版本交过来的监听socket可能是阻塞的
+    }
+    for( int i = inherited; i < count; i++ )
+    {
+        listenfds[i] = create_listenfd( config.ip, config.port, reactor_number > 0, config.backlog );
+    }
+    // 第i个反应堆绑定到topo.cpu(i)；SO_INCOMING_CPU让内核在SO_REUSEPORT组中优先选握手所在CPU上的监听socket
+    int* cpus = new int[ count ];
+    for( int i = 0; i < count; i++ )
+    {
+        cpus[i] = placed ? topo.cpu( i ) : -1;
+        if( placed && reactor_number > 0 )
         {
-            int sockfd = events[i].data.fd;
-            if(sockfd == listenfd) // 监听到了什么
-            {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof( client_address );
-                int connfd = accept( listenfd, ( struct sockaddr* )&client_address, &client_addrlength );
-                if ( connfd < 0 )
-                {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                }
-                if( http_conn::m_user_count >= MAX_FD ) // user_count>=65536
-                {
-                    show_error( connfd, "Internal server busy" );
-                    continue;
-                }
-                /*初始化客户连接*/
-                users[connfd].init( connfd, client_address );
-            }
-            else if( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+            setsockopt( listenfds[i], SOL_SOCKET, SO_INCOMING_CPU, &cpus[i], sizeof( cpus[i] ) );
+        }
+        if( placed )
+        {
+            printf( "reactor %d -> cpu %d (node %d)\n", i, cpus[i], topo.node( cpus[i] ) );
+        }
+    }
+    if( placed && pool )
+    {
+        build_steering( topo, config.workers, &steering );
+    }
+#ifdef IO_URING
+    if( use_uring )
+    {
+        uring_reactor** reactors = new uring_reactor*[ count ];
+        for( int i = 0; i < count; i++ )
+        {
+            int fd = listenfds[i];
+            reactors[i] = create_on_cpu< uring_reactor >( cpus[i], [i, fd, &config]{ return new uring_reactor( i, fd, config ); } );
+            if( !reactors[i] )
             {
-				/*如果有异常，直接关闭客户连接*/
-                users[sockfd].close_conn();
+                return 1;
             }
-            else if( events[i].events & EPOLLIN )
+        }
+        if( !run_reactors( reactors, count, signals, argv, listenfds, handoff_channel ) )
+        {
+            return 1;
+        }
+        for( int i = 0; i < count; i++ )
+        {
+            delete reactors[i];
+        }
+        delete [] reactors;
+    }
+    else
+#endif
+    {
+        reactor** reactors = new reactor*[ count ];
+        for( int i = 0; i < count; i++ )
+        {
+            int fd = listenfds[i];
+            reactors[i] = create_on_cpu< reactor >( cpus[i], [i, fd, pool, &config]{ return new reactor( i, fd, pool, config ); } );
+            if( !reactors[i] )
             {
-				/*根据读的结果，决定是将任务添加到线程池还是关闭连接*/
-                if( users[sockfd].read() )
-                {
-                    pool->append( users + sockfd );
-                }
-                else
-                {
-                    users[sockfd].close_conn();
-                }
+                return 1;
             }
-            else if( events[i].events & EPOLLOUT ) // 对于EPOLLOUT: 如果状态改变了[比如 从满到不满],只要输出缓冲区可写就会触发
+            if( placed && pool )
             {
-				/*根据写的结果，决定是否关闭连接*/
-                if( !users[sockfd].write() )
-                {
-                    users[sockfd].close_conn();
-                }
+                reactors[i]->set_steering( &steering );
             }
-            else
-            {}
         }
+        if( !run_reactors( reactors, count, signals, argv, listenfds, handoff_channel ) )
+        {
+            return 1;
+        }
+        for( int i = 0; i < count; i++ )
+        {
+            delete reactors[i];
+        }
+        delete [] reactors;
     }
 
-    close( epollfd );
-    close( listenfd );
-    delete [] users;
+    for( int i = 0; i < count; i++ )
+    {
+        close( listenfds[i] );
+    }
+    delete [] listenfds;
+    delete [] cpus;
     delete pool;
+    delete http_conn::m_io_pool; // 反应堆退出前已等待所有交给I/O线程的连接回来
+    access_log::stop();
+    delete http_conn::m_file_cache;
     return 0;
 }
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "metrics.h"
+
+std::atomic<thread_metrics*> metrics::m_head( NULL );
+thread_metrics* metrics::m_free = NULL;
+locker metrics::m_free_lock;
+
+struct metrics::block_owner
+{
+    thread_metrics* block;
+    ~block_owner(){
+        if( block ){
+            m_free_lock.lock();
+            block->free_next = m_free;
+            m_free = block;
+            m_free_lock.unlock();
+        }
+    }
+};
+
+// 指标名、标签、说明；同名的计数器连续排列，只输出一次HELP/TYPE
+static const char* counter_names[COUNTER_NUMBER][3] = {
+    {"http_accepts_total", NULL, "Accepted connections."},
+    {"http_rejects_total", NULL, "Connections refused because the connection limit was reached."},
+    {"http_responses_total", "code=\"200\"", "Responses by status code."},
+    {"http_responses_total", "code=\"206\"", NULL},
+    {"http_responses_total", "code=\"304\"", NULL},
+    {"http_responses_total", "code=\"400\"", NULL},
+    {"http_responses_total", "code=\"403\"", NULL},
+    {"http_responses_total", "code=\"404\"", NULL},
+    {"http_responses_total", "code=\"416\"", NULL},
+    {"http_responses_total", "code=\"500\"", NULL},
+    {"http_sent_bytes_total", NULL, "Bytes sent, headers and bodies."},
+    {"http_epollout_rearms_total", NULL, "Writes that filled the socket send buffer and waited for EPOLLOUT."},
+    {"http_timeouts_total", "kind=\"idle\"", "Connections closed by the idle, header-read or write timeout."},
+    {"http_timeouts_total", "kind=\"header\"", NULL},
+    {"http_timeouts_total", "kind=\"write\"", NULL},
+    {"http_pool_rejects_total", NULL, "Requests answered 503 because the thread pool queue was full."},
+    {"http_io_offloads_total", NULL, "Requests whose file was loaded from disk by the I/O thread pool."},
+};
+
+static const char* histogram_names[HISTOGRAM_NUMBER][2] = {
+    {"http_queue_wait_seconds", "Time a request waited in the thread pool queue."},
+    {"http_parse_seconds", "Duration of one process_read() call."},
+    {"http_file_open_seconds", "Time do_request() spent getting the file from the file cache."},
+    {"http_write_seconds", "Duration of one write() call."},
+};
+
+void latency_histogram::observe( uint64_t ns ){
+    // 单写者，load+store即可
+    count.store( count.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    sum_ns.store( sum_ns.load( std::memory_order_relaxed ) + ns, std::memory_order_relaxed );
+    int idx = ns <= ( 1ULL << MIN_SHIFT ) ? 0 : 64 - __builtin_clzll( ns - 1 ) - MIN_SHIFT;
+    if( idx < BUCKETS ){
+        buckets[idx].store( buckets[idx].load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    }
+}
+
+thread_metrics* metrics::create(){
+    static thread_local block_owner owner = {NULL};
+    // 先复用已退出线程的数据块，计数在它原来的基础上累加
+    m_free_lock.lock();
+    thread_metrics* block = m_free;
+    if( block ){
+        m_free = block->free_next;
+    }
+    m_free_lock.unlock();
+    if( block ){
+        owner.block = block;
+        return block;
+    }
+    block = new thread_metrics();
+    for( int i = 0; i < COUNTER_NUMBER; i++ ){
+        block->counters[i].store( 0, std::memory_order_relaxed );
+    }
+    for( int i = 0; i < HISTOGRAM_NUMBER; i++ ){
+        latency_histogram& h = block->histograms[i];
+        for( int j = 0; j < latency_histogram::BUCKETS; j++ ){
+            h.buckets[j].store( 0, std::memory_order_relaxed );
+        }
+        h.count.store( 0, std::memory_order_relaxed );
+        h.sum_ns.store( 0, std::memory_order_relaxed );
+    }
+    // 无锁头插，只在线程第一次记录时发生
+    thread_metrics* head = m_head.load( std::memory_order_relaxed );
+    do{
+        block->next = head;
+    }while( !m_head.compare_exchange_weak( head, block, std::memory_order_release, std::memory_order_relaxed ) );
+    owner.block = block;
+    return block;
+}
+
+uint64_t metrics::counter( COUNTER_ID id ){
+    uint64_t total = 0;
+    for( thread_metrics* p = m_head.load( std::memory_order_acquire ); p; p = p->next ){
+        total += p->counters[id].load( std::memory_order_relaxed );
+    }
+    return total;
+}
+
+static void appendf( std::string& out, const char* format, ... ){
+    char line[256];
+    va_list args;
+    va_start( args, format );
+    int len = vsnprintf( line, sizeof( line ), format, args );
+    va_end( args );
+    if( len > 0 ){
+        out.append( line, len < ( int )sizeof( line ) ? len : sizeof( line ) - 1 );
+    }
+}
+
+void metrics::render( std::string& out ){
+    for( int i = 0; i < COUNTER_NUMBER; i++ ){
+        const char* name = counter_names[i][0];
+        const char* label = counter_names[i][1];
+        if( counter_names[i][2] ){
+            appendf( out, "# HELP %s %s\n# TYPE %s counter\n", name, counter_names[i][2], name );
+        }
+        unsigned long long value = counter( ( COUNTER_ID )i );
+        if( label ){
+            appendf( out, "%s{%s} %llu\n", name, label, value );
+        }
+        else{
+            appendf( out, "%s %llu\n", name, value );
+        }
+    }
+
+    for( int i = 0; i < HISTOGRAM_NUMBER; i++ ){
+        uint64_t buckets[latency_histogram::BUCKETS] = {0};
+        uint64_t count = 0, sum_ns = 0;
+        for( thread_metrics* p = m_head.load( std::memory_order_acquire ); p; p = p->next ){
+            const latency_histogram& h = p->histograms[i];
+            for( int j = 0; j < latency_histogram::BUCKETS; j++ ){
+                buckets[j] += h.buckets[j].load( std::memory_order_relaxed );
+            }
+            count += h.count.load( std::memory_order_relaxed );
+            sum_ns += h.sum_ns.load( std::memory_order_relaxed );
+        }
+        const char* name = histogram_names[i][0];
+        appendf( out, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_names[i][1], name );
+        // Prometheus的桶是累计的
+        uint64_t cumulative = 0;
+        for( int j = 0; j < latency_histogram::BUCKETS; j++ ){
+            cumulative += buckets[j];
+            appendf( out, "%s_bucket{le=\"%g\"} %llu\n", name, ( double )( 1ULL << ( j + latency_histogram::MIN_SHIFT ) ) / 1e9,
+                     ( unsigned long long )cumulative );
+        }
+        // 各线程的计数不是同一时刻读取的，保证+Inf不小于最后一个桶
+        if( count < cumulative ){
+            count = cumulative;
+        }
+        appendf( out, "%s_bucket{le=\"+Inf\"} %llu\n", name, ( unsigned long long )count );
+        appendf( out, "%s_sum %.9f\n", name, sum_ns / 1e9 );
+        appendf( out, "%s_count %llu\n", name, ( unsigned long long )count );
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+
+#include "locker.h"
+
+/*
+运行指标：每个线程一块独立的计数器和直方图，只有所属线程写入（普通的load+store，不需要原子读-改-写，
+也不会在线程间争用缓存行），/__stats请求时遍历所有线程的数据块汇总，输出Prometheus文本格式。
+数据块在线程第一次记录时分配并挂到全局链表上，线程退出后仍保留，计数不会丢失；
+退出线程的数据块放进空闲链表，由之后新建的线程（如线程池扩容）接着使用，数据块数不超过同时存在过的线程数。
+*/
+
+// 计数器
+enum COUNTER_ID {
+    COUNTER_ACCEPTS = 0,        //接受的连接数
+    COUNTER_REJECTS,            //因连接数达到上限而拒绝的连接数
+    COUNTER_RESPONSES_200,      //按状态码统计的响应数
+    COUNTER_RESPONSES_206,
+    COUNTER_RESPONSES_304,
+    COUNTER_RESPONSES_400,
+    COUNTER_RESPONSES_403,
+    COUNTER_RESPONSES_404,
+    COUNTER_RESPONSES_416,
+    COUNTER_RESPONSES_500,
+    COUNTER_BYTES_SENT,         //发送的字节数（响应头+响应体）
+    COUNTER_EPOLLOUT_REARMS,    //socket发送缓冲区满，等待EPOLLOUT的次数
+    COUNTER_TIMEOUT_IDLE,       //各类超时关闭的连接数，顺序与http_conn::TIMER_KIND一致
+    COUNTER_TIMEOUT_HEADER,
+    COUNTER_TIMEOUT_WRITE,
+    COUNTER_POOL_REJECTS,       //线程池队列已满，回复503并关闭的连接数
+    COUNTER_IO_OFFLOADS,        //目标文件交给I/O线程池加载的请求数
+    COUNTER_NUMBER
+};
+
+// 耗时直方图
+enum HISTOGRAM_ID {
+    HISTOGRAM_QUEUE_WAIT = 0,   //请求在线程池队列中等待的时间
+    HISTOGRAM_PARSE,            //一次process_read()的耗时
+    HISTOGRAM_FILE_OPEN,        //do_request()从文件缓存取得目标文件的耗时
+    HISTOGRAM_WRITE,            //一次write()的耗时
+    HISTOGRAM_NUMBER
+};
+
+/*
+按2的幂分桶的耗时直方图：第i个桶统计不超过2^(i+MIN_SHIFT)纳秒（256ns ~ 约4.3秒）的次数，超出的只计入count
+*/
+struct latency_histogram
+{
+    static const int MIN_SHIFT = 8;
+    static const int BUCKETS = 25;
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+
+    void observe(uint64_t ns);
+};
+
+struct thread_metrics
+{
+    std::atomic<uint64_t> counters[COUNTER_NUMBER];
+    latency_histogram histograms[HISTOGRAM_NUMBER];
+    thread_metrics* next;   //全局链表
+    thread_metrics* free_next;  //空闲链表，所属线程退出后使用
+};
+
+class metrics
+{
+public:
+    static void add(COUNTER_ID id, uint64_t n = 1){
+        std::atomic<uint64_t>& c = local()->counters[id];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void observe(HISTOGRAM_ID id, uint64_t ns){
+        local()->histograms[id].observe(ns);
+    }
+    static uint64_t now_ns(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    // 粗粒度单调时钟(ms)，走vDSO，不产生系统调用；各反应堆的时间轮和文件缓存的重新校验共用这一个时钟
+    static long now_ms(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+    static uint64_t counter(COUNTER_ID id);         //所有线程的合计
+    static void render(std::string& out);           //汇总并输出Prometheus文本格式
+
+private:
+    static thread_metrics* local(){
+        static thread_local thread_metrics* block = NULL;
+        if(!block)
+            block = create();
+        return block;
+    }
+    static thread_metrics* create();                //取一个空闲的数据块，没有时分配并登记
+    struct block_owner;                             //线程退出时把数据块放回空闲链表
+    static std::atomic<thread_metrics*> m_head;
+    static thread_metrics* m_free;
+    static locker m_free_lock;
+};
+
+#endif
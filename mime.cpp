@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <unordered_map>
+
+#include "mime.h"
+
+struct mime_def
+{
+    const char* ext;
+    const char* type;
+};
+
+static constexpr mime_def builtin_types[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"xhtml", "application/xhtml+xml"},
+    {"css", "text/css"},
+    {"js", "text/javascript"},
+    {"mjs", "text/javascript"},
+    {"json", "application/json"},
+    {"jsonld", "application/ld+json"},
+    {"map", "application/json"},
+    {"webmanifest", "application/manifest+json"},
+    {"xml", "application/xml"},
+    {"rss", "application/rss+xml"},
+    {"atom", "application/atom+xml"},
+    {"txt", "text/plain"},
+    {"csv", "text/csv"},
+    {"md", "text/markdown"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"ico", "image/x-icon"},
+    {"bmp", "image/bmp"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"mp3", "audio/mpeg"},
+    {"ogg", "audio/ogg"},
+    {"wav", "audio/wav"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"tar", "application/x-tar"},
+    {"wasm", "application/wasm"},
+};
+static constexpr int BUILTIN_NUMBER = sizeof( builtin_types ) / sizeof( builtin_types[0] );
+static constexpr unsigned MIME_TABLE_SHIFT = 7;
+static constexpr unsigned MIME_TABLE_SIZE = 1u << MIME_TABLE_SHIFT;
+static constexpr int MAX_EXT_LEN = 15;
+static constexpr size_t MAX_TYPE_LEN = 127;    //文件缓存预生成的响应头长度有限
+
+constexpr char lower( char c ){
+    return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c;
+}
+
+// 带种子的FNV-1a，取高位作为槽位；种子在编译期搜索，使内置扩展名互不冲突
+static constexpr unsigned ext_hash( const char* ext, int len, unsigned seed ){
+    unsigned h = 2166136261u ^ seed;
+    for( int i = 0; i < len; i++ ){
+        h = ( h ^ ( unsigned char )lower( ext[i] ) ) * 16777619u;
+    }
+    return h >> ( 32 - MIME_TABLE_SHIFT );
+}
+
+constexpr int const_strlen( const char* s ){
+    int n = 0;
+    while( s[n] ){
+        n++;
+    }
+    return n;
+}
+
+struct mime_table
+{
+    unsigned seed;
+    unsigned char slot[MIME_TABLE_SIZE];    //builtin_types的下标+1，0表示空
+};
+
+static constexpr bool try_seed( unsigned seed, mime_table& table ){
+    for( unsigned i = 0; i < MIME_TABLE_SIZE; i++ ){
+        table.slot[i] = 0;
+    }
+    for( int i = 0; i < BUILTIN_NUMBER; i++ ){
+        unsigned s = ext_hash( builtin_types[i].ext, const_strlen( builtin_types[i].ext ), seed );
+        if( table.slot[s] ){
+            return false;
+        }
+        table.slot[s] = i + 1;
+    }
+    table.seed = seed;
+    return true;
+}
+
+static constexpr mime_table build_mime_table(){
+    mime_table table = {};
+    for( unsigned seed = 0; seed < 100000; seed++ ){
+        if( try_seed( seed, table ) ){
+            return table;
+        }
+    }
+    table.seed = ~0u;
+    return table;
+}
+
+static constexpr mime_table mime_slots = build_mime_table();
+static_assert( mime_slots.seed != ~0u, "no perfect hash seed for the built-in MIME table, enlarge MIME_TABLE_SIZE" );
+
+// 启动时从文件载入的扩展名（小写）到类型，之后只读
+static std::unordered_map< std::string, std::string > custom_types;
+
+const char* mime_type( const char* path ){
+    const char* dot = strrchr( path, '.' );
+    if( !dot || strchr( dot, '/' ) ){
+        return MIME_DEFAULT_TYPE;
+    }
+    const char* ext = dot + 1;
+    int len = strlen( ext );
+    if( len == 0 || len > MAX_EXT_LEN ){
+        return MIME_DEFAULT_TYPE;
+    }
+    if( !custom_types.empty() ){
+        char key[MAX_EXT_LEN + 1];
+        for( int i = 0; i <= len; i++ ){
+            key[i] = lower( ext[i] );
+        }
+        std::unordered_map< std::string, std::string >::const_iterator it = custom_types.find( key );
+        if( it != custom_types.end() ){
+            return it->second.c_str();
+        }
+    }
+    unsigned char index = mime_slots.slot[ ext_hash( ext, len, mime_slots.seed ) ];
+    // 槽位唯一确定候选扩展名，只需一次不区分大小写的比较确认
+    if( index && strcasecmp( builtin_types[ index - 1 ].ext, ext ) == 0 ){
+        return builtin_types[ index - 1 ].type;
+    }
+    return MIME_DEFAULT_TYPE;
+}
+
+int load_mime_types( const char* path ){
+    FILE* fp = fopen( path, "r" );
+    if( !fp ){
+        return -1;
+    }
+    int count = 0;
+    char line[1024];
+    while( fgets( line, sizeof( line ), fp ) ){
+        char* comment = strchr( line, '#' );
+        if( comment ){
+            *comment = '\0';
+        }
+        char* save = NULL;
+        char* type = strtok_r( line, " \t\r\n", &save );
+        if( !type || strlen( type ) > MAX_TYPE_LEN ){
+            continue;
+        }
+        for( char* ext = strtok_r( NULL, " \t\r\n", &save ); ext; ext = strtok_r( NULL, " \t\r\n", &save ) ){
+            int len = strlen( ext );
+            if( len > MAX_EXT_LEN ){
+                continue;
+            }
+            for( int i = 0; i < len; i++ ){
+                ext[i] = lower( ext[i] );
+            }
+            custom_types[ ext ] = type;
+            count++;
+        }
+    }
+    fclose( fp );
+    return count;
+}
@@ -0,0 +1,19 @@
+#ifndef MIME_H
+#define MIME_H
+
+/*
+按文件扩展名确定Content-Type
+内置表在编译期生成完美哈希（O(1)查找，一次比较确认），启动时可以从mime.types格式的文件补充或覆盖；
+查找结果由文件缓存保存在条目中，命中时不再查找。
+*/
+
+#define MIME_DEFAULT_TYPE "application/octet-stream"  //未知扩展名的类型
+
+// path的扩展名对应的类型，返回的字符串在进程运行期间一直有效
+const char* mime_type(const char* path);
+
+// 载入mime.types格式的文件（每行"类型 扩展名 扩展名..."，#开始注释），覆盖内置表中的同名扩展名；
+// 只能在启动时、开始服务请求之前调用，返回载入的扩展名个数，文件无法打开时返回-1
+int load_mime_types(const char* path);
+
+#endif
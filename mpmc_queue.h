@@ -0,0 +1,131 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <exception>
+
+#define CACHE_LINE_SIZE 64
+
+// 自旋等待时提示CPU降低功耗、让出流水线给超线程
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/*
+有界多生产者多消费者无锁环形队列（Vyukov算法）
+每个槽位带一个序号：序号等于入队位置时可写，等于入队位置+1时可读，
+生产者和消费者各自用CAS推进入队/出队位置，不需要互斥锁，也不会为每个元素分配内存。
+入队、出队位置分别独占一个缓存行，避免生产者和消费者之间的伪共享。
+*/
+template<typename T>
+class mpmc_queue
+{
+public:
+    explicit mpmc_queue(size_t limit);
+    ~mpmc_queue();
+
+    bool push(const T& data);   //队列已满（达到limit）时返回false
+    bool pop(T& data);          //队列为空时返回false
+    size_t size() const;        //近似的元素个数
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    alignas(CACHE_LINE_SIZE) cell* m_buffer;
+    size_t m_mask;              //容量-1，容量为不小于limit的2的幂
+    size_t m_limit;             //允许的最大元素个数
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+};
+
+template<typename T>
+mpmc_queue<T>::mpmc_queue(size_t limit) : m_limit(limit), m_enqueue_pos(0), m_dequeue_pos(0)
+{
+    if(limit == 0)
+        throw std::exception();
+    size_t capacity = 2;
+    while(capacity < limit)
+        capacity <<= 1;
+    m_mask = capacity - 1;
+    m_buffer = new cell[capacity];
+    for(size_t i = 0; i < capacity; i++)
+        m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template<typename T>
+mpmc_queue<T>::~mpmc_queue()
+{
+    delete[] m_buffer;
+}
+
+template<typename T>
+bool mpmc_queue<T>::push(const T& data)
+{
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while(true){
+        // 保持max_requests的背压语义：积压达到上限时拒绝入队
+        if(pos - m_dequeue_pos.load(std::memory_order_relaxed) >= m_limit)
+            return false;
+        cell* c = &m_buffer[pos & m_mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0){
+            if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                c->data = data;
+                c->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0){
+            return false;       //槽位还未被消费，队列已满
+        }
+        else{
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<typename T>
+bool mpmc_queue<T>::pop(T& data)
+{
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while(true){
+        cell* c = &m_buffer[pos & m_mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(diff == 0){
+            if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                data = c->data;
+                c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0){
+            return false;       //槽位还未被写入，队列为空
+        }
+        else{
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<typename T>
+size_t mpmc_queue<T>::size() const
+{
+    size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif
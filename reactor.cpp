@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+
+#include "reactor.h"
+#include "topology.h"
+
+extern void addfd( int epollfd, int fd, bool one_shot, void* ptr, bool edge );
+
+// 非阻塞地回复503，不关闭连接
+static void send_busy( int connfd )
+{
+    static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+    // 先读走已经到达的请求，关闭时接收缓冲区中有未读数据会发RST，客户端可能收不到503
+    char discard[4096];
+    ssize_t n = recv( connfd, discard, sizeof( discard ), MSG_DONTWAIT );
+    n = send( connfd, busy, sizeof( busy ) - 1, MSG_DONTWAIT | MSG_NOSIGNAL );
+    ( void )n;
+}
+
+void shed_connection( int connfd )
+{
+    send_busy( connfd );
+    close( connfd );
+}
+
+reactor::reactor( int id, int listenfd, http_pool* pool, const server_config& config )
+    : m_id( id ), m_listenfd( listenfd ), m_cpu( -1 ), m_steer( NULL ), m_max_conn( config.max_conn ), m_max_events( config.max_events ), m_accept_budget( config.accept_budget ),
+      m_drain_timeout_ms( config.drain_timeout_ms ), m_draining( false ), m_drain_deadline( 0 ), m_pool( pool ), m_edge( pool == NULL ), m_buffers( config.buffer_cache, pool != NULL ), m_timers( metrics::now_ms() ), m_thread( 0 )
+{
+    m_ready.prev = m_ready.next = &m_ready;
+    set_timeouts( config.idle_timeout_ms, config.header_timeout_ms, config.write_timeout_ms );
+    // 升级时fork出的新进程不能继承这些fd
+    m_epollfd = epoll_create1( EPOLL_CLOEXEC );
+    if( m_epollfd == -1 )
+    {
+        throw std::exception();
+    }
+    m_stopfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( m_stopfd == -1 )
+    {
+        close( m_epollfd );
+        throw std::exception();
+    }
+    m_spare_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+    m_events = new epoll_event[ m_max_events ];
+    addfd( m_epollfd, m_listenfd, false, NULL, false );
+    addfd( m_epollfd, m_stopfd, false, &m_stopfd, false );
+    addfd( m_epollfd, m_io_done.fd(), false, &m_io_done, false );
+}
+
+reactor::~reactor()
+{
+    if( m_spare_fd >= 0 )
+    {
+        close( m_spare_fd );
+    }
+    close( m_stopfd );
+    close( m_epollfd );
+    delete [] m_events;
+}
+
+void reactor::set_timeouts( int idle_ms, int header_ms, int write_ms )
+{
+    m_timeout_ms[ http_conn::TIMER_IDLE ] = idle_ms;
+    m_timeout_ms[ http_conn::TIMER_HEADER ] = header_ms;
+    m_timeout_ms[ http_conn::TIMER_WRITE ] = write_ms;
+}
+
+bool reactor::start()
+{
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    if( m_cpu >= 0 )
+    {
+        set_thread_cpu( &attr, m_cpu );
+    }
+    bool ok = pthread_create( &m_thread, &attr, worker, this ) == 0;
+    pthread_attr_destroy( &attr );
+    return ok;
+}
+
+void reactor::join()
+{
+    if( m_thread )
+    {
+        pthread_join( m_thread, NULL );
+        m_thread = 0;
+    }
+}
+
+void reactor::stop()
+{
+    uint64_t one = 1;
+    ssize_t n = ::write( m_stopfd, &one, sizeof( one ) );
+    ( void )n;
+}
+
+void* reactor::worker( void* arg )
+{
+    reactor* r = ( reactor* )arg;
+    r->loop();
+    return r;
+}
+
+// 循环处理epoll返回的事件
+void reactor::loop()
+{
+    while( !m_draining || m_conns.used() > 0 )
+    {
+        // 有连接时最多睡到下一个tick，以便及时处理超时；就绪链表上还有连接时不等待
+        int timeout = m_ready.next != &m_ready ? 0 : m_timers.next_timeout( metrics::now_ms() );
+        if( m_draining && ( timeout < 0 || timeout > DRAIN_POLL_MS ) )
+        {
+            timeout = DRAIN_POLL_MS; // 排空时定期检查截止时间
+        }
+        int number = epoll_wait( m_epollfd, m_events, m_max_events, timeout );
+        if ( ( number < 0 ) && ( errno != EINTR ) )
+        {
+            printf( "reactor %d: epoll failure\n", m_id );
+            break;
+        }
+        if( m_timers.size() == 0 )
+        {
+            // 时间轮为空时epoll_wait可能睡了很久，先把时间轮拨到当前时间，本轮新添加的定时器才能从现在算起
+            m_timers.advance( metrics::now_ms(), on_timeout, this );
+        }
+
+        for ( int i = 0; i < number; i++ )
+        {
+            http_conn* conn = ( http_conn* )m_events[i].data.ptr;
+            if( !conn ) // 监听socket
+            {
+                if( !m_draining )
+                {
+                    handle_accept();
+                }
+                continue;
+            }
+            if( m_events[i].data.ptr == &m_stopfd )
+            {
+                drain();
+                continue;
+            }
+            if( m_events[i].data.ptr == &m_io_done )
+            {
+                resume();
+                continue;
+            }
+            if( m_edge && conn->busy() )
+            {
+                // 请求在I/O线程中等待磁盘，边沿触发的事件不会再来，记下有新数据，恢复后的读写会发现连接的其他变化
+                if( m_events[i].events & EPOLLIN )
+                {
+                    conn->m_read_blocked = false;
+                }
+                continue;
+            }
+            if( conn->busy() )
+            {
+                // 线程池模式：工作线程重新注册事件后还没记下处理到的序号（它对连接的最后一次访问），
+                // 此时读、写或关闭连接都会和它冲突，事件挂到就绪链表，等它记下之后再处理
+                conn->m_deferred_events |= m_events[i].events;
+                defer( conn );
+                continue;
+            }
+            handle_event( conn, m_events[i].events );
+        }
+        run_ready();
+        // 定时器放在事件之后处理，关闭连接不会影响本轮尚未处理的事件
+        m_timers.advance( metrics::now_ms(), on_timeout, this );
+        if( m_draining && metrics::now_ms() >= m_drain_deadline )
+        {
+            m_timers.for_each( close_quiet, this );
+        }
+    }
+}
+
+void reactor::handle_event( http_conn* conn, uint32_t events )
+{
+    if( events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+    {
+        /*如果有异常，直接关闭客户连接*/
+        close_conn( conn );
+    }
+    else if( m_edge )
+    {
+        serve( conn, events );
+    }
+    else if( events & EPOLLIN )
+    {
+        handle_read( conn );
+    }
+    else if( events & EPOLLOUT ) // 对于EPOLLOUT: 如果状态改变了[比如 从满到不满],只要输出缓冲区可写就会触发
+    {
+        handle_write( conn );
+    }
+}
+
+void reactor::drain()
+{
+    if( m_draining )
+    {
+        return;
+    }
+    m_draining = true;
+    m_drain_deadline = metrics::now_ms() + m_drain_timeout_ms;
+    // 监听socket只从epoll中移除，由main关闭或已交给新进程
+    epoll_ctl( m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL );
+    epoll_ctl( m_epollfd, EPOLL_CTL_DEL, m_stopfd, NULL );
+    // 之后发完响应变为空闲的连接在下一个tick关闭
+    m_timeout_ms[ http_conn::TIMER_IDLE ] = 0;
+    m_timers.for_each( close_idle, this );
+}
+
+void reactor::close_idle( timer_node* node, void* arg )
+{
+    reactor* r = ( reactor* )arg;
+    http_conn* conn = ( http_conn* )node->data;
+    if( conn->busy() || conn->writing() || conn->parse_pending() || conn->m_ready.linked() )
+    {
+        return;
+    }
+    // keep-alive空闲连接，或者还没有收到请求的任何字节的新连接；请求已经到达socket但还没读入的不关闭，否则客户端会收到RST
+    if( ( conn->m_timer_kind == http_conn::TIMER_IDLE || conn->m_read_idx == conn->m_request_start ) && !conn->input_pending() )
+    {
+        r->close_conn( conn );
+    }
+}
+
+void reactor::close_quiet( timer_node* node, void* arg )
+{
+    reactor* r = ( reactor* )arg;
+    http_conn* conn = ( http_conn* )node->data;
+    if( !conn->busy() )
+    {
+        r->close_conn( conn );
+    }
+}
+
+void reactor::close_conn( http_conn* conn )
+{
+    m_timers.remove( &conn->m_timer );
+    if( conn->m_ready.linked() )
+    {
+        conn->m_ready.prev->next = conn->m_ready.next;
+        conn->m_ready.next->prev = conn->m_ready.prev;
+        conn->m_ready.next = NULL;
+    }
+    conn->close_conn();
+    m_conns.free( conn );
+}
+
+void reactor::arm( http_conn* conn, http_conn::TIMER_KIND kind )
+{
+    conn->m_timer_kind = kind;
+    conn->m_timer.data = conn;
+    m_timers.add( &conn->m_timer, m_timeout_ms[kind] );
+}
+
+void reactor::on_timeout( timer_node* node, void* arg )
+{
+    reactor* r = ( reactor* )arg;
+    http_conn* conn = ( http_conn* )node->data;
+    if( conn->busy() )
+    {
+        // 工作线程仍在处理该连接，不能在这里关闭，一个tick后再检查
+        r->m_timers.add( &conn->m_timer, 1 );
+        return;
+    }
+    metrics::add( ( COUNTER_ID )( COUNTER_TIMEOUT_IDLE + conn->m_timer_kind ) );
+    r->close_conn( conn );
+}
+
+void reactor::handle_accept()
+{
+    // 监听socket是水平触发的，预算用完时下一轮epoll_wait立即返回继续accept
+    for( int i = 0; i < m_accept_budget; i++ )
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+        int connfd = accept4( m_listenfd, ( struct sockaddr* )&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( connfd < 0 )
+        {
+            if( errno == EINTR || errno == ECONNABORTED )
+            {
+                continue;
+            }
+            if( ( errno == EMFILE || errno == ENFILE ) && m_spare_fd >= 0 )
+            {
+                // fd用尽：不处理的话监听socket一直可读，反应堆空转；用备用fd取出一个连接拒绝掉
+                close( m_spare_fd );
+                connfd = accept4( m_listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+                if( connfd >= 0 )
+                {
+                    metrics::add( COUNTER_REJECTS );
+                    shed_connection( connfd );
+                }
+                m_spare_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+            }
+            else if( errno != EAGAIN )
+            {
+                printf( "errno is: %d\n", errno );
+            }
+            return;
+        }
+        http_conn* conn = NULL;
+        if( http_conn::m_user_count >= m_max_conn || !( conn = m_conns.alloc() ) )
+        {
+            metrics::add( COUNTER_REJECTS );
+            shed_connection( connfd );
+            continue;
+        }
+        metrics::add( COUNTER_ACCEPTS );
+        /*初始化客户连接，连接此后只由本反应堆的epoll监听*/
+        conn->init( connfd, client_address, m_epollfd, &m_buffers, m_edge );
+        conn->m_home = connfd;
+        if( http_conn::m_io_pool )
+        {
+            conn->m_io_task.done = &m_io_done;
+        }
+        if( m_steer )
+        {
+            // 握手的数据包由哪个CPU处理（网卡RSS/RPS决定），就交给那个CPU或同一节点上的工作线程
+            int cpu = -1;
+            socklen_t len = sizeof( cpu );
+            int worker = getsockopt( connfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len ) == 0 ? m_steer->pick( cpu, connfd ) : -1;
+            if( worker >= 0 )
+            {
+                conn->m_home = worker;
+            }
+        }
+        arm( conn, http_conn::TIMER_HEADER ); // 新连接要在限定时间内发来第一个请求
+    }
+}
+
+void reactor::handle_read( http_conn* conn )
+{
+    /*根据读的结果，决定是将任务添加到线程池（或就地处理）还是关闭连接*/
+    if( !conn->read() )
+    {
+        close_conn( conn );
+        return;
+    }
+    // 新请求的第一批数据到达时开始计算请求读取超时，同一个请求后续的数据不刷新，慢速发送的客户端无法一直占住连接
+    if( conn->m_timer_kind != http_conn::TIMER_HEADER )
+    {
+        arm( conn, http_conn::TIMER_HEADER );
+    }
+    dispatch( conn );
+}
+
+void reactor::dispatch( http_conn* conn )
+{
+    conn->m_dispatched.fetch_add( 1, std::memory_order_relaxed );
+    if( m_pool )
+    {
+        conn->m_enqueue_ns = metrics::now_ns();
+        if( !m_pool->append( conn, conn->m_home ) ) // 工作窃取策略下同一连接固定在一个工作线程
+        {
+            // 队列已满（线程池已扩到上限仍处理不过来）：连接没有交出去，不能让它一直等下去，回复503后关闭
+            conn->m_processed.store( conn->m_dispatched.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+            conn->m_enqueue_ns = 0;
+            metrics::add( COUNTER_POOL_REJECTS );
+            send_busy( conn->m_sockfd );
+            close_conn( conn );
+        }
+    }
+    else
+    {
+        conn->process();
+    }
+}
+
+void reactor::resume()
+{
+    m_io_done.take( m_resumed );
+    for( size_t i = 0; i < m_resumed.size(); i++ )
+    {
+        http_conn* conn = m_resumed[i];
+        dispatch( conn );
+        if( m_edge )
+        {
+            serve( conn, 0 ); // 发送生成的响应，继续处理之后的请求
+        }
+    }
+    m_resumed.clear();
+}
+
+void reactor::handle_write( http_conn* conn )
+{
+    /*根据写的结果，决定是否关闭连接*/
+    if( !conn->write() )
+    {
+        close_conn( conn );
+    }
+    else if( conn->writing() )
+    {
+        arm( conn, http_conn::TIMER_WRITE ); // 有进展，重新计算写超时
+    }
+    else if( conn->parse_pending() )
+    {
+        arm( conn, http_conn::TIMER_HEADER );
+        dispatch( conn ); // 上一批流水线响应已发完，继续处理缓冲区中剩余的请求
+    }
+    else
+    {
+        conn->release_buffers(); // 空闲的keep-alive连接不占用缓冲区
+        arm( conn, http_conn::TIMER_IDLE ); // 响应发完，等待keep-alive连接上的下一个请求
+    }
+}
+
+void reactor::serve( http_conn* conn, uint32_t events )
+{
+    if( events & EPOLLIN )
+    {
+        conn->m_read_blocked = false; // 有新数据到达
+    }
+    if( conn->busy() )
+    {
+        return; // 就绪链表上的连接已交给I/O线程池，加载完后resume()继续
+    }
+    int budget = EDGE_READ_BUDGET;
+    bool idle = false;
+    while( true )
+    {
+        if( conn->writing() )
+        {
+            // 不记录socket是否可写，直接尝试：发送缓冲区满时sendmsg立即返回EAGAIN，等EPOLLOUT边沿再继续
+            size_t left = conn->bytes_to_send;
+            if( !conn->write() )
+            {
+                close_conn( conn );
+                return;
+            }
+            if( conn->writing() )
+            {
+                if( conn->bytes_to_send < left )
+                {
+                    arm( conn, http_conn::TIMER_WRITE ); // 有进展，重新计算写超时
+                }
+                return;
+            }
+            idle = true;
+            continue;
+        }
+        if( conn->parse_pending() )
+        {
+            arm( conn, http_conn::TIMER_HEADER );
+            dispatch( conn ); // 上一批流水线响应已发完，继续处理缓冲区中剩余的请求
+            if( conn->busy() )
+            {
+                return;
+            }
+            continue;
+        }
+        if( conn->m_read_blocked )
+        {
+            break;
+        }
+        if( budget-- == 0 )
+        {
+            defer( conn );
+            return;
+        }
+        int unread = conn->m_read_idx - conn->m_request_start;
+        if( !conn->read() )
+        {
+            close_conn( conn );
+            return;
+        }
+        if( conn->m_read_idx - conn->m_request_start > unread )
+        {
+            // 新请求的第一批数据到达时开始计算请求读取超时，同一个请求后续的数据不刷新
+            if( conn->m_timer_kind != http_conn::TIMER_HEADER )
+            {
+                arm( conn, http_conn::TIMER_HEADER );
+            }
+            idle = false;
+            dispatch( conn );
+            if( conn->busy() )
+            {
+                return; // 交给了I/O线程池，连接不能再读写
+            }
+        }
+    }
+    if( idle )
+    {
+        conn->release_buffers(); // 空闲的keep-alive连接不占用缓冲区
+        arm( conn, http_conn::TIMER_IDLE ); // 响应发完，等待keep-alive连接上的下一个请求
+    }
+}
+
+void reactor::defer( http_conn* conn )
+{
+    timer_node* node = &conn->m_ready;
+    if( node->linked() )
+    {
+        return;
+    }
+    node->data = conn;
+    node->prev = m_ready.prev;
+    node->next = &m_ready;
+    m_ready.prev->next = node;
+    m_ready.prev = node;
+}
+
+void reactor::run_ready()
+{
+    // 先把整个链表摘下来，处理过程中再次用完预算的连接排到下一轮
+    timer_node pending;
+    if( m_ready.next == &m_ready )
+    {
+        return;
+    }
+    pending.next = m_ready.next;
+    pending.prev = m_ready.prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    m_ready.prev = m_ready.next = &m_ready;
+    while( pending.next != &pending )
+    {
+        timer_node* node = pending.next;
+        pending.next = node->next;
+        node->next->prev = &pending;
+        node->next = NULL;
+        http_conn* conn = ( http_conn* )node->data;
+        if( m_edge )
+        {
+            serve( conn, 0 );
+        }
+        else if( conn->busy() )
+        {
+            defer( conn ); // 工作线程还没记下序号，下一轮再看
+        }
+        else
+        {
+            uint32_t events = conn->m_deferred_events;
+            conn->m_deferred_events = 0;
+            handle_event( conn, events );
+        }
+    }
+}
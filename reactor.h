@@ -0,0 +1,104 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <vector>
+
+#include "locker.h"
+#include "threadpool.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+#include "slab.h"
+#include "config.h"
+#include "io_stage.h"
+
+struct worker_steering;
+
+// 连接上限、超时、accept预算等可配置的参数见config.h
+#define DRAIN_POLL_MS 100           //排空时事件循环至少这么久醒来一次
+#define EDGE_READ_BUDGET 16         //边沿触发时一个连接每次最多read()的轮数，用完后留到下一轮，一个连接不会占住反应堆
+
+// 线程池调度策略在编译时选择（make POOL=steal），便于A/B对比
+#ifdef WORK_STEALING
+typedef threadpool< http_conn, stealing_queue< http_conn > > http_pool;
+#else
+typedef threadpool< http_conn, fifo_queue< http_conn > > http_pool;
+#endif
+
+/*
+反应堆：一个epoll实例 + 一个监听socket + 一个事件循环
+单反应堆模式：主线程运行唯一的reactor，解析交给线程池（m_pool非空）
+多反应堆模式：每个核心一个reactor线程，各自拥有SO_REUSEPORT监听socket，
+             连接的accept、读、解析、写都在同一个线程内完成（m_pool为空）
+             连接固定在本线程，以边沿触发注册一次读写事件，读写进行到EAGAIN为止，不再逐次epoll_ctl重新注册
+冷文件：使用I/O线程池时（http_conn::m_io_pool），需要访问磁盘的请求交给I/O线程，加载完后经完成队列回到本反应堆重新分派
+停止：stop()通过eventfd唤醒事件循环，不再accept，关闭空闲的keep-alive连接，
+     其余连接发完进行中的响应后关闭（http_conn::m_draining），全部关闭或超过drain_timeout_ms后loop()返回
+*/
+// 拒绝一个连接：丢弃已到达的请求，非阻塞地回复503后关闭，不会阻塞反应堆
+void shed_connection(int connfd);
+
+class reactor
+{
+public:
+    reactor(int id, int listenfd, http_pool* pool, const server_config& config);
+    ~reactor();
+
+    void loop();                    //事件循环
+    bool start();                   //在新线程中运行事件循环
+    void join();                    //等待事件循环线程退出
+    void stop();                    //可在任意线程调用，通知事件循环排空连接后退出
+    void set_cpu(int cpu) {m_cpu = cpu;}    //start()之前调用，事件循环线程绑定到cpu
+    // 线程池模式下按SO_INCOMING_CPU把连接交给同一CPU或节点上的工作线程，start()之前调用
+    void set_steering(const worker_steering* steer) {m_steer = steer;}
+    void set_timeouts(int idle_ms, int header_ms, int write_ms);
+    size_t connections() const {return m_conns.used();}     //本反应堆的在线连接数
+
+private:
+    static void* worker(void* arg); //线程回调函数，arg其实是this
+    void handle_accept();           //连续accept监听socket上排队的新连接
+    void handle_read(http_conn* conn);  //处理连接上的读事件
+    void handle_write(http_conn* conn); //处理连接上的写事件
+    void handle_event(http_conn* conn, uint32_t events); //按epoll事件关闭、读或写连接
+    void serve(http_conn* conn, uint32_t events); //边沿触发：读、处理、写，直到读写都遇到EAGAIN或预算用完
+    void defer(http_conn* conn);        //预算用完的连接（线程池模式下是事件到达时仍忙碌的连接）挂到就绪链表，下一轮继续
+    void run_ready();                   //处理就绪链表上的连接
+    void dispatch(http_conn* conn);     //解析并处理连接上已读入的请求
+    void resume();                      //重新分派I/O线程加载完目标文件的连接
+    void close_conn(http_conn* conn);   //删除定时器、关闭连接并释放连接对象
+    void arm(http_conn* conn, http_conn::TIMER_KIND kind); //按超时类型为连接重新计时
+    static void on_timeout(timer_node* node, void* arg);  //时间轮到期回调
+    void drain();                       //停止accept并关闭空闲连接
+    static void close_idle(timer_node* node, void* arg);  //关闭没有未完成请求的连接
+    static void close_quiet(timer_node* node, void* arg); //排空超时，关闭没有在工作线程中处理的连接
+
+private:
+    int m_id;                       //反应堆编号
+    int m_epollfd;                  //本反应堆独占的epoll实例
+    int m_listenfd;                 //本反应堆的监听socket
+    int m_stopfd;                   //stop()写入的eventfd
+    io_completions m_io_done;       //I/O线程加载完目标文件的连接
+    std::vector< http_conn* > m_resumed;    //从m_io_done取出、等待重新分派的连接
+    int m_cpu;                      //事件循环线程绑定的CPU，-1表示不绑定
+    const worker_steering* m_steer; //CPU到工作线程的映射，为NULL时按fd分配
+    int m_spare_fd;                 //fd用尽时临时关闭它，腾出一个fd来accept并拒绝排队的连接
+    int m_max_conn;                 //所有反应堆合计的在线连接上限
+    int m_max_events;               //m_events的长度
+    int m_accept_budget;
+    int m_drain_timeout_ms;
+    bool m_draining;                //正在排空，不再accept
+    long m_drain_deadline;          //排空的截止时间
+    http_pool* m_pool;              //为空时在本线程内直接处理请求
+    bool m_edge;                    //连接以边沿触发注册（就地处理时）
+    timer_node m_ready;             //就绪链表的哨兵，链表非空时epoll_wait不等待
+    epoll_event* m_events;          //epoll_wait返回的事件数组
+    slab<http_conn> m_conns;        //本反应堆的连接对象，epoll事件的data.ptr指向它们
+    buffer_pool m_buffers;          //本反应堆连接借用的读写缓冲区
+    timer_wheel m_timers;           //本反应堆所有连接的超时定时器
+    int m_timeout_ms[3];            //各类超时的时长，按TIMER_KIND索引
+    pthread_t m_thread;
+};
+
+#endif
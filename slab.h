@@ -0,0 +1,78 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <new>
+#include <vector>
+#include <stdlib.h>
+
+/*
+定长对象的slab分配器：按块（每块chunk_objects个对象）向系统申请内存，
+释放的对象挂在空闲链表上供下次分配，块内尚未用过的部分按需切分，没用到的页不会被访问。
+不加锁，只由所属的反应堆线程分配和释放；块在分配器销毁前不归还。
+*/
+template<typename T>
+class slab{
+public:
+    explicit slab(int chunk_objects = 64);
+    ~slab();
+    T* alloc();             //取一个对象并默认构造，内存不足时返回NULL
+    void free(T* obj);      //析构对象并放回空闲链表
+    size_t used() const {return m_used;}
+    size_t capacity() const {return m_chunks.size() * m_chunk_objects;}
+
+private:
+    union node{
+        node* next;                                 //空闲时指向下一个空闲对象
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    int m_chunk_objects;
+    node* m_free;               //空闲链表
+    node* m_bump;               //当前块中还没用过的第一个对象
+    node* m_bump_end;
+    std::vector<node*> m_chunks;
+    size_t m_used;
+};
+
+template<typename T>
+slab<T>::slab(int chunk_objects)
+    : m_chunk_objects(chunk_objects > 0 ? chunk_objects : 1), m_free(NULL), m_bump(NULL), m_bump_end(NULL), m_used(0) {}
+
+template<typename T>
+slab<T>::~slab(){
+    // 仍在使用的对象由调用者负责，这里只归还内存
+    for(size_t i = 0; i < m_chunks.size(); i++)
+        ::free(m_chunks[i]);
+}
+
+template<typename T>
+T* slab<T>::alloc(){
+    node* n = m_free;
+    if(n){
+        m_free = n->next;
+    }
+    else{
+        if(m_bump == m_bump_end){
+            node* chunk = (node*)malloc(sizeof(node) * m_chunk_objects);
+            if(!chunk)
+                return NULL;
+            m_chunks.push_back(chunk);
+            m_bump = chunk;
+            m_bump_end = chunk + m_chunk_objects;
+        }
+        n = m_bump++;
+    }
+    m_used++;
+    return new(n->storage) T();
+}
+
+template<typename T>
+void slab<T>::free(T* obj){
+    obj->~T();
+    node* n = (node*)obj;
+    n->next = m_free;
+    m_free = n;
+    m_used--;
+}
+
+#endif
@@ -1,103 +1,535 @@
 #ifndef THREAD_H
 #define THREAD_H
 
-#include <list>
+#include <atomic>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "locker.h"
+#include "mpmc_queue.h"
+#include "chase_lev_deque.h"
+
+/*
+线程池的调度策略（模板参数Queue）需要提供：
+    Queue(int thread_number, int max_requests);   //thread_number为工作线程数的上限
+    bool push(T* request, unsigned key);   //key用于连接亲和，队列已满时返回false
+    T* pop(int worker);                    //worker为工作线程编号，被唤醒但没有任务时返回NULL
+    void wake_all();                       //线程池停止或有线程退出时唤醒所有休眠的工作线程，每个线程至少从pop返回一次
+    void set_active(int n);                //当前运行的是编号0..n-1的工作线程，新请求只按key投递给它们
+    bool idle(int worker);                 //worker退出前确认没有只能由它处理的请求
+*/
+
+/*
+FIFO策略：所有工作线程共享一个无锁有界环形队列 + 先自旋后休眠的等待方式
+空闲工作线程先自旋一小段时间，仍取不到任务才在信号量上休眠；
+生产者只在有线程休眠时才post信号量，队列繁忙时入队不产生futex系统调用。
+*/
+template<typename T>
+class fifo_queue{
+public:
+    fifo_queue(int thread_number, int max_requests)
+        : m_queue(max_requests), m_thread_number(thread_number), m_spin_limit(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0), m_sleepers(0) {}
+    bool push(T* request, unsigned key);    //队列已满时返回false，key不使用
+    T* pop(int worker);                     //阻塞直到取到任务，被唤醒但没有任务时返回NULL
+    void wake_all();
+    void set_active(int n) {}               //所有线程共享一个队列，线程数变化不影响投递
+    bool idle(int worker) {return true;}
+
+private:
+    static const int SPIN_LIMIT = 256;  //休眠前的自旋次数
+    mpmc_queue<T*> m_queue;
+    int m_thread_number;
+    int m_spin_limit;                   //单核机器上自旋只会抢占生产者的CPU，不自旋
+    sem m_sem;                          //休眠线程在此等待
+    alignas(CACHE_LINE_SIZE) std::atomic<int> m_sleepers; //正在或即将休眠的线程数
+};
+
+template<typename T>
+bool fifo_queue<T>::push(T* request, unsigned key){
+    if(!m_queue.push(request))
+        return false;
+    // 与pop中的m_sleepers自增配对：二者之间必须有全屏障，否则可能入队后没有唤醒刚要休眠的线程
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleepers.load(std::memory_order_relaxed) > 0)
+        m_sem.post();
+    return true;
+}
+
+template<typename T>
+T* fifo_queue<T>::pop(int worker){
+    T* request = NULL;
+    for(int i = 0; i < m_spin_limit; i++){
+        if(m_queue.pop(request))
+            return request;
+        cpu_relax();
+    }
+    m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+    // 宣告休眠后再检查一次，防止错过在自旋结束后入队的任务
+    if(m_queue.pop(request)){
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        return request;
+    }
+    m_sem.wait();
+    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+    return m_queue.pop(request) ? request : NULL;
+}
+
+template<typename T>
+void fifo_queue<T>::wake_all(){
+    // 每个线程停止前至多再等待一次，post线程数次就能唤醒所有线程，多余的计数无害
+    for(int i = 0; i < m_thread_number; i++)
+        m_sem.post();
+}
+
+/*
+工作窃取策略：每个工作线程一个收件箱（无锁环形队列）和一个Chase-Lev双端队列
+反应堆按key（连接fd）把请求投递到固定线程的收件箱，同一连接总在同一个线程上处理，读写缓冲区保持在该核的缓存中；
+工作线程把收件箱中的请求成批搬到自己的双端队列里处理，空闲线程从其他线程的双端队列顶部和收件箱中窃取。
+*/
+template<typename T>
+class stealing_queue{
+public:
+    stealing_queue(int thread_number, int max_requests);
+    ~stealing_queue();
+    bool push(T* request, unsigned key);    //投递到key对应线程，其收件箱满时依次尝试其他线程
+    T* pop(int worker);
+    void wake_all();
+    void set_active(int n) {m_active.store(n, std::memory_order_relaxed);}
+    bool idle(int worker) {return m_slots[worker].deque.size() == 0 && m_slots[worker].inbox->size() == 0;}
+
+private:
+    static const int SPIN_LIMIT = 256;  //休眠前的自旋次数
+    static const int BATCH = 8;         //每次从收件箱搬运到双端队列的最大请求数
+
+    struct alignas(CACHE_LINE_SIZE) slot{
+        mpmc_queue<T*>* inbox;          //反应堆投递的请求
+        chase_lev_deque<T*> deque;      //本线程待处理的请求，其他线程可从顶部窃取
+        sem wakeup;                     //本线程休眠时在此等待
+        std::atomic<int> sleeping;      //本线程是否正在或即将休眠
+    };
+
+    bool take(int worker, T*& request); //从自己的队列中取
+    bool steal(int worker, T*& request);//从其他线程窃取
+    void wake(int worker);              //线程休眠时唤醒它
+
+    int m_thread_number;
+    int m_spin_limit;
+    slot* m_slots;
+    std::atomic<int> m_active;          //运行中的线程数，按key投递时只选它们；其余线程的收件箱只在前面都满时使用，由运行中的线程窃取
+};
+
+template<typename T>
+stealing_queue<T>::stealing_queue(int thread_number, int max_requests)
+    : m_thread_number(thread_number), m_spin_limit(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0), m_active(thread_number){
+    m_slots = new slot[thread_number];
+    // 总积压上限仍为max_requests，平均分给各线程
+    int per_thread = (max_requests + thread_number - 1) / thread_number;
+    for(int i = 0; i < thread_number; i++){
+        m_slots[i].inbox = new mpmc_queue<T*>(per_thread);
+        m_slots[i].sleeping.store(0, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+stealing_queue<T>::~stealing_queue(){
+    for(int i = 0; i < m_thread_number; i++)
+        delete m_slots[i].inbox;
+    delete[] m_slots;
+}
+
+template<typename T>
+void stealing_queue<T>::wake(int worker){
+    int expected = 1;
+    if(m_slots[worker].sleeping.compare_exchange_strong(expected, 0))
+        m_slots[worker].wakeup.post();
+}
+
+template<typename T>
+void stealing_queue<T>::wake_all(){
+    for(int i = 0; i < m_thread_number; i++){
+        m_slots[i].sleeping.store(0, std::memory_order_seq_cst);
+        m_slots[i].wakeup.post();
+    }
+}
+
+template<typename T>
+bool stealing_queue<T>::push(T* request, unsigned key){
+    int target = key % m_active.load(std::memory_order_relaxed);
+    int i = 0;
+    for(; i < m_thread_number; i++){
+        if(m_slots[(target + i) % m_thread_number].inbox->push(request))
+            break;
+    }
+    if(i == m_thread_number)
+        return false;
+    target = (target + i) % m_thread_number;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_slots[target].sleeping.load(std::memory_order_relaxed)){
+        wake(target);
+        return true;
+    }
+    // 目标线程正忙，唤醒一个休眠的线程来窃取
+    for(int j = 1; j < m_thread_number; j++){
+        int victim = (target + j) % m_thread_number;
+        if(m_slots[victim].sleeping.load(std::memory_order_relaxed)){
+            wake(victim);
+            break;
+        }
+    }
+    return true;
+}
 
 template<typename T>
+bool stealing_queue<T>::take(int worker, T*& request){
+    slot& self = m_slots[worker];
+    if(self.deque.pop(request))
+        return true;
+    T* batch[BATCH];
+    int n = 0;
+    while(n < BATCH && self.inbox->pop(batch[n]))
+        n++;
+    if(n == 0)
+        return false;
+    // 逆序放入底部：本线程从底部按到达顺序处理，窃取者从顶部拿走最晚到达的
+    for(int k = n - 1; k > 0; k--)
+        self.deque.push(batch[k]);
+    request = batch[0];
+    return true;
+}
+
+template<typename T>
+bool stealing_queue<T>::steal(int worker, T*& request){
+    for(int i = 1; i < m_thread_number; i++){
+        slot& victim = m_slots[(worker + i) % m_thread_number];
+        if(victim.deque.steal(request) || victim.inbox->pop(request))
+            return true;
+    }
+    return false;
+}
+
+template<typename T>
+T* stealing_queue<T>::pop(int worker){
+    T* request = NULL;
+    for(int i = 0; i <= m_spin_limit; i++){
+        if(take(worker, request) || steal(worker, request))
+            return request;
+        cpu_relax();
+    }
+    slot& self = m_slots[worker];
+    self.sleeping.store(1, std::memory_order_seq_cst);
+    // 宣告休眠后再检查一次，防止错过刚投递的请求
+    if(take(worker, request) || steal(worker, request)){
+        int expected = 1;
+        if(!self.sleeping.compare_exchange_strong(expected, 0))
+            self.wakeup.wait();     //已经有生产者post，消耗掉这次唤醒
+        return request;
+    }
+    self.wakeup.wait();
+    return NULL;
+}
+
+/*
+线程池的运行状态，由调整线程更新，/__stats读取
+*/
+struct pool_stats{
+    std::atomic<int> workers;           //运行中的工作线程数
+    std::atomic<int> max_workers;
+    std::atomic<long> queue_wait_us;    //最近一个调整周期估计的排队时间
+    std::atomic<long> queued;           //最近一次采样时排队的请求数
+    std::atomic<unsigned long> grows;   //扩容和缩容的次数
+    std::atomic<unsigned long> shrinks;
+};
+
+/*
+自适应线程数：max_threads大于thread_number时，线程池另起一个调整线程，每ADAPT_INTERVAL_MS采样一次：
+- 排队时间按Little定律估计：排队的请求数 / 这段时间内被取走的请求数 × 周期；有排队却一个也没取走（工作线程都阻塞在
+  冷磁盘的stat/缺页上）时按已经卡住的时长计。超过target_wait_ms时加线程，超得越多加得越多，直到max_threads；
+  上次加线程后取走的速度没有提高（CPU已经跑满）时暂停扩容一段时间，避免白白增加线程
+- 连续ADAPT_IDLE_ROUNDS个周期没有排队且采样时正在处理请求的线程不到一半时减一个线程，最少保留thread_number个
+编号大的线程先退出：调整线程先把运行数减一，该线程处理完手上的请求、确认没有只能由它处理的请求后退出，由调整线程回收
+*/
+#define ADAPT_INTERVAL_MS 100
+#define ADAPT_IDLE_ROUNDS 50        //空闲5秒才缩容
+#define ADAPT_BACKOFF_ROUNDS 20     //扩容无效时暂停扩容2秒
+
+template<typename T, typename Queue = fifo_queue<T> >
 class threadpool{
 private:
     int thread_number;      //线程池中的线程数
     int max_requests;       //请求队列中允许的最大请求数
-    pthread_t* threads;     //线程池，即线程数组，大小为thread_number
-    std::list<T*> request_queue;//请求队列
-    locker queue_locker;    //保护请求队列的互斥锁
-    sem queue_sem;          //是否有任务需要处理
-    bool stop;              //是否结束线程
+    int max_threads;        //线程数的上限，等于thread_number时不调整
+    long target_wait_us;    //排队时间的目标
+    struct alignas(CACHE_LINE_SIZE) worker_slot{
+        threadpool* pool;
+        int id;             //工作线程编号，与创建顺序和绑定的CPU一致，工作窃取策略据此找到自己的队列
+        pthread_t thread;
+        bool started;       //线程已创建且尚未被回收
+        std::atomic<bool> exited;
+        std::atomic<unsigned long> taken;   //本线程取走的请求数，只由本线程写
+        std::atomic<unsigned long> done;    //其中已处理完的
+    };
+    worker_slot* slots;     //大小为max_threads
+    int* cpus;              //非空时第i个线程绑定到cpus[i % cpu_count]
+    int cpu_count;
+    Queue request_queue;    //请求队列，调度策略由模板参数决定
+    std::atomic<bool> stop; //是否结束线程
+    std::atomic<int> active;//运行中的线程数，编号不小于它的线程退出
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned long> pushed; //入队的请求数
+    pool_stats m_stats;
+    pthread_t controller;   //调整线程，不调整时为0
 
     //不断从请求队列中取出任务并执行
     static void* worker(void* arg);
-    void run();
+    void run(int id);
+    bool spawn(int id);     //创建第id个工作线程
+    static void* control(void* arg);
+    void adapt();           //调整线程的主循环
+    void shutdown();        //设置stop、唤醒并join所有已创建的线程
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000);
-    ~threadpool();
-    bool append(T* request);
+    // cpus非空时第i个工作线程绑定到cpus[i % cpu_count]；max_threads大于thread_number时按排队时间在两者之间调整线程数
+    threadpool(int thread_number = 8, int max_requests = 10000, const int* cpus = NULL, int cpu_count = 0,
+               int max_threads = 0, int target_wait_ms = 10);
+    ~threadpool();          //通知所有工作线程退出并等待它们结束，调用前不能再有新的请求
+    bool append(T* request, unsigned key = 0); //key相同的请求尽量交给同一个工作线程，队列已满时返回false
+    const pool_stats& stats() const {return m_stats;}
 };
 
-template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests){
+template<typename T, typename Queue>
+threadpool<T, Queue>::threadpool(int thread_number, int max_requests, const int* cpus, int cpu_count, int max_threads, int target_wait_ms)
+    : request_queue(max_threads > thread_number ? max_threads : (thread_number > 0 ? thread_number : 1), max_requests > 0 ? max_requests : 1),
+      stop(false), active(0), pushed(0), controller(0){
     if(thread_number <= 0 || max_requests <= 0)
         throw std::exception();
     this->thread_number = thread_number;
     this->max_requests = max_requests;
-    this->stop = false;
-    
-    this->threads = new pthread_t[this->thread_number];
-    if(!this->threads)
-        throw std::exception(); 
-    for(int i = 0; i < this->thread_number; i++){
-        //循环创建线程，并将工作线程按要求进行运行
-        if(pthread_create(this->threads + i, NULL, worker, this) != 0){
-            delete[] this->threads;
-            throw std::exception();
-        }
-        //让线程分离  ----工作线程完成后自动释放所有资源,无需单独回收
-        if(pthread_detach(this->threads[i])){
-            delete[] this->threads;
+    this->max_threads = max_threads > thread_number ? max_threads : thread_number;
+    this->target_wait_us = target_wait_ms * 1000L;
+    this->cpu_count = cpus ? cpu_count : 0;
+    this->cpus = NULL;
+    if(this->cpu_count > 0){
+        this->cpus = new int[this->cpu_count];
+        for(int i = 0; i < this->cpu_count; i++)
+            this->cpus[i] = cpus[i];
+    }
+    m_stats.workers.store(0);
+    m_stats.max_workers.store(this->max_threads);
+    m_stats.queue_wait_us.store(0);
+    m_stats.queued.store(0);
+    m_stats.grows.store(0);
+    m_stats.shrinks.store(0);
+
+    this->slots = new worker_slot[this->max_threads];
+    for(int i = 0; i < this->max_threads; i++){
+        this->slots[i].pool = this;
+        this->slots[i].id = i;
+        this->slots[i].started = false;
+        this->slots[i].exited.store(false);
+        this->slots[i].taken.store(0);
+        this->slots[i].done.store(0);
+    }
+    request_queue.set_active(thread_number);
+    active.store(thread_number);
+    for(int i = 0; i < thread_number; i++){
+        if(!spawn(i)){
+            shutdown();
             throw std::exception();
         }
-        printf("%dth thread has been created\n", i);
+    }
+    m_stats.workers.store(thread_number);
+    if(this->max_threads > thread_number && pthread_create(&controller, NULL, control, this) != 0){
+        controller = 0;
+        printf("thread pool: cannot start the controller, pool size fixed at %d\n", thread_number);
     }
 }
 
-template<typename T>
-threadpool<T>::~threadpool(){
-    delete[] this->threads;
-    this->stop = true;
+template<typename T, typename Queue>
+bool threadpool<T, Queue>::spawn(int id){
+    worker_slot& slot = this->slots[id];
+    slot.exited.store(false);
+    // 绑定CPU时在创建前设置，线程从一开始就运行在目标CPU上，栈也分配在该CPU的节点上
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(this->cpu_count > 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(this->cpus[id % this->cpu_count], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    //线程保持可join，退出或析构时等待它们处理完手上的请求
+    int ret = pthread_create(&slot.thread, &attr, worker, &slot);
+    pthread_attr_destroy(&attr);
+    if(ret != 0)
+        return false;
+    slot.started = true;
+    if(this->cpu_count > 0)
+        printf("%dth thread has been created on cpu %d\n", id, this->cpus[id % this->cpu_count]);
+    else
+        printf("%dth thread has been created\n", id);
+    return true;
+}
+
+template<typename T, typename Queue>
+threadpool<T, Queue>::~threadpool(){
+    shutdown();
+}
+
+template<typename T, typename Queue>
+void threadpool<T, Queue>::shutdown(){
+    this->stop.store(true, std::memory_order_seq_cst);
+    if(controller)
+        pthread_join(controller, NULL);
+    request_queue.wake_all();
+    for(int i = 0; i < this->max_threads; i++){
+        if(this->slots[i].started)
+            pthread_join(this->slots[i].thread, NULL);
+    }
+    delete[] this->slots;
+    delete[] this->cpus;
+    this->slots = NULL;
+    this->cpus = NULL;
 }
 
 //将“待办工作”加入到请求队列
-template<typename T>
-bool threadpool<T>::append(T* request){
-    queue_locker.lock();
-    if(request_queue.size() >= max_requests){
-        queue_locker.unlock();
+template<typename T, typename Queue>
+bool threadpool<T, Queue>::append(T* request, unsigned key){
+    if(!request_queue.push(request, key)) //积压达到max_requests时返回false
         return false;
-    }
-    request_queue.push_back(request);
-    queue_locker.unlock();
-    queue_sem.post();
+    pushed.fetch_add(1, std::memory_order_relaxed);
     return true;
 }
 
-//线程回调函数/工作函数，arg其实是this
-template<typename T>
-void* threadpool<T>::worker(void* arg){
-    threadpool* pool = (threadpool*) arg; //将参数强转为线程池类，调用成员方法
-    pool->run();
-    return pool;
+//线程回调函数/工作函数，arg是该线程的worker_slot
+template<typename T, typename Queue>
+void* threadpool<T, Queue>::worker(void* arg){
+    worker_slot* slot = (worker_slot*) arg;
+    slot->pool->run(slot->id);
+    slot->exited.store(true, std::memory_order_release);
+    return slot->pool;
 }
 /*
 被回调函数调用
-不断等待任务队列中的新任务，然后加锁取任务->取到任务并解锁->执行任务
+不断按调度策略取任务（取不到时先自旋再休眠）->执行任务，被缩容且没有只能由自己处理的请求时退出
 */
-template<typename T>
-void threadpool<T>::run(){
-    while(!stop){
-        queue_sem.wait();           //信号量等待
-        queue_locker.lock();        //被唤醒后加上互斥锁
-        if(request_queue.empty()){
-            queue_locker.unlock();
-            continue;
-        }
-        T* request = request_queue.front();
-        request_queue.pop_front();
-        queue_locker.unlock();
+template<typename T, typename Queue>
+void threadpool<T, Queue>::run(int id){
+    std::atomic<unsigned long>& taken = this->slots[id].taken;
+    std::atomic<unsigned long>& done = this->slots[id].done;
+    while(!stop.load(std::memory_order_acquire)){
+        if(id >= active.load(std::memory_order_acquire) && request_queue.idle(id))
+            break;
+        T* request = request_queue.pop(id);
         if(!request)
             continue;
+        taken.store(taken.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         request->process();
+        done.store(taken.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+template<typename T, typename Queue>
+void* threadpool<T, Queue>::control(void* arg){
+    ((threadpool*) arg)->adapt();
+    return arg;
+}
+
+template<typename T, typename Queue>
+void threadpool<T, Queue>::adapt(){
+    const long interval_us = ADAPT_INTERVAL_MS * 1000L;
+    struct timespec tick = {0, ADAPT_INTERVAL_MS * 1000000L};
+    unsigned long last_taken = 0;
+    long stalled_us = 0;        //有排队却没有线程取走请求已经持续的时间
+    int idle_rounds = 0;
+    int backoff = 0;
+    unsigned long rate_before_grow = 0; //上次扩容前一个周期取走的请求数，0表示上次没有扩容
+    while(!stop.load(std::memory_order_acquire)){
+        nanosleep(&tick, NULL);
+        int n = active.load(std::memory_order_relaxed);
+        // 回收已经退出的线程，编号可以再次使用
+        bool retiring = false;
+        for(int i = n; i < this->max_threads; i++){
+            if(!this->slots[i].started)
+                continue;
+            if(this->slots[i].exited.load(std::memory_order_acquire)){
+                pthread_join(this->slots[i].thread, NULL);
+                this->slots[i].started = false;
+            }
+            else
+                retiring = true;
+        }
+        if(retiring)
+            request_queue.wake_all(); //正在退出的线程可能还在休眠
+
+        unsigned long taken = 0;
+        for(int i = 0; i < this->max_threads; i++)
+            taken += this->slots[i].taken.load(std::memory_order_relaxed);
+        long queued = (long)(pushed.load(std::memory_order_relaxed) - taken);
+        if(queued < 0)
+            queued = 0;     //两个计数不是同时读取的
+        unsigned long rate = taken - last_taken;
+        last_taken = taken;
+        long wait_us = 0;
+        if(queued > 0 && rate == 0){
+            stalled_us += interval_us;
+            wait_us = stalled_us;
+        }
+        else{
+            stalled_us = 0;
+            wait_us = rate > 0 ? (long)(queued * interval_us / rate) : 0;
+        }
+        m_stats.queue_wait_us.store(wait_us, std::memory_order_relaxed);
+        m_stats.queued.store(queued, std::memory_order_relaxed);
+
+        if(backoff > 0)
+            backoff--;
+        // 上次扩容后取走的速度没有提高至少5%：瓶颈不在线程数上
+        if(rate_before_grow > 0 && rate * 20 < rate_before_grow * 21)
+            backoff = ADAPT_BACKOFF_ROUNDS;
+        rate_before_grow = 0;
+
+        if(wait_us > target_wait_us && n < this->max_threads && backoff == 0){
+            idle_rounds = 0;
+            // 超出目标越多一次加得越多，最多加到现有线程数的一半
+            int step = wait_us > 4 * target_wait_us ? (n / 2 > 1 ? n / 2 : 1) : 1;
+            int target = n;
+            while(target < n + step && target < this->max_threads && !this->slots[target].started)
+                target++;
+            // 先提高运行数再创建，新线程启动时不会认为自己已被缩容
+            active.store(target, std::memory_order_release);
+            int grown = n;
+            while(grown < target && spawn(grown))
+                grown++;
+            active.store(grown, std::memory_order_release);
+            if(grown > n){
+                request_queue.set_active(grown);
+                m_stats.workers.store(grown, std::memory_order_relaxed);
+                m_stats.grows.fetch_add(1, std::memory_order_relaxed);
+                rate_before_grow = rate;
+                printf("thread pool: %d -> %d workers, queue wait ~%ld ms, %ld queued\n", n, grown, wait_us / 1000, queued);
+            }
+            continue;
+        }
+        // 正在处理请求的线程数
+        int busy = 0;
+        for(int i = 0; i < n; i++){
+            if(this->slots[i].taken.load(std::memory_order_relaxed) != this->slots[i].done.load(std::memory_order_relaxed))
+                busy++;
+        }
+        if(queued == 0 && busy * 2 < n && n > this->thread_number)
+            idle_rounds++;
+        else
+            idle_rounds = 0;
+        if(idle_rounds >= ADAPT_IDLE_ROUNDS){
+            idle_rounds = 0;
+            request_queue.set_active(n - 1);
+            active.store(n - 1, std::memory_order_release);
+            m_stats.workers.store(n - 1, std::memory_order_relaxed);
+            m_stats.shrinks.fetch_add(1, std::memory_order_relaxed);
+            request_queue.wake_all();
+            printf("thread pool: %d -> %d workers, idle\n", n, n - 1);
+        }
     }
 }
 #endif
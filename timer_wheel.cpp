@@ -0,0 +1,130 @@
+#include "timer_wheel.h"
+
+timer_wheel::timer_wheel( long now_ms, int tick_ms )
+    : m_base_ms( now_ms ), m_tick_ms( tick_ms ), m_current( 0 ), m_count( 0 )
+{
+    for( int i = 0; i < L0_SIZE; i++ ){
+        m_l0[i].prev = m_l0[i].next = &m_l0[i];
+    }
+    for( int i = 0; i < L1_SIZE; i++ ){
+        m_l1[i].prev = m_l1[i].next = &m_l1[i];
+    }
+}
+
+void timer_wheel::push( timer_node* head, timer_node* node ){
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void timer_wheel::link( timer_node* node ){
+    long delta = node->expire - m_current;
+    if( delta < 0 ){
+        delta = 0;
+        node->expire = m_current;
+    }
+    if( delta < L0_SIZE ){
+        push( &m_l0[ node->expire & ( L0_SIZE - 1 ) ], node );
+        return;
+    }
+    // 超出第1级范围的按最远处理，到时再重新分配
+    long max_delta = ( long )L0_SIZE * L1_SIZE - 1;
+    long expire = delta > max_delta ? m_current + max_delta : node->expire;
+    push( &m_l1[ ( expire >> L0_BITS ) & ( L1_SIZE - 1 ) ], node );
+}
+
+void timer_wheel::add( timer_node* node, long timeout_ms ){
+    remove( node );
+    // 向上取整到tick，保证不会提前到期
+    node->expire = m_current + ( timeout_ms + m_tick_ms - 1 ) / m_tick_ms;
+    link( node );
+    m_count++;
+}
+
+void timer_wheel::remove( timer_node* node ){
+    if( !node->linked() ){
+        return;
+    }
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+    m_count--;
+}
+
+int timer_wheel::next_timeout( long now_ms ) const {
+    if( m_count == 0 ){
+        return -1;
+    }
+    long next_ms = m_base_ms + m_current * m_tick_ms;
+    return next_ms > now_ms ? ( int )( next_ms - now_ms ) : 0;
+}
+
+void timer_wheel::advance( long now_ms, expire_callback cb, void* arg ){
+    long target = ( now_ms - m_base_ms ) / m_tick_ms;
+    if( m_count == 0 ){
+        // 时间轮为空，直接跳到当前tick
+        if( target >= m_current ){
+            m_current = target + 1;
+        }
+        return;
+    }
+    while( m_current <= target ){
+        // 第0级转完一圈，把第1级对应槽中的定时器分配到第0级
+        if( ( m_current & ( L0_SIZE - 1 ) ) == 0 ){
+            timer_node* head = &m_l1[ ( m_current >> L0_BITS ) & ( L1_SIZE - 1 ) ];
+            timer_node* node = head->next;
+            head->prev = head->next = head;
+            while( node != head ){
+                timer_node* next = node->next;
+                link( node );
+                node = next;
+            }
+        }
+        // 先把当前槽整体摘下，回调中重新添加的定时器不会落入正在遍历的链表
+        timer_node expired;
+        timer_node* head = &m_l0[ m_current & ( L0_SIZE - 1 ) ];
+        if( head->next != head ){
+            expired.next = head->next;
+            expired.prev = head->prev;
+            expired.next->prev = &expired;
+            expired.prev->next = &expired;
+            head->prev = head->next = head;
+        }
+        else{
+            expired.prev = expired.next = &expired;
+        }
+        m_current++;
+        while( expired.next != &expired ){
+            timer_node* node = expired.next;
+            remove( node );
+            cb( node, arg );
+        }
+    }
+}
+
+void timer_wheel::for_each( expire_callback cb, void* arg ){
+    // 先摘下所有节点，回调中删除或重新添加节点不会影响遍历
+    timer_node pending;
+    pending.prev = pending.next = &pending;
+    timer_node* heads[2] = {m_l0, m_l1};
+    int sizes[2] = {L0_SIZE, L1_SIZE};
+    for( int level = 0; level < 2; level++ ){
+        for( int i = 0; i < sizes[level]; i++ ){
+            timer_node* head = &heads[level][i];
+            while( head->next != head ){
+                timer_node* node = head->next;
+                head->next = node->next;
+                node->next->prev = head;
+                push( &pending, node );
+            }
+        }
+    }
+    while( pending.next != &pending ){
+        timer_node* node = pending.next;
+        pending.next = node->next;
+        node->next->prev = &pending;
+        link( node );   //放回原来的槽，到期时间不变
+        cb( node, arg );
+    }
+}
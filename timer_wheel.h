@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+
+/*
+侵入式定时器节点，嵌入在被管理的对象（如http_conn）中，添加、删除、刷新都是O(1)且不分配内存
+*/
+struct timer_node
+{
+    timer_node* prev;
+    timer_node* next;       //为NULL表示不在时间轮中
+    long expire;            //到期的tick
+    void* data;             //所属对象
+
+    timer_node() : prev( NULL ), next( NULL ), expire( 0 ), data( NULL ) {}
+    bool linked() const { return next != NULL; }
+};
+
+/*
+两级分层时间轮：第0级256个槽，每槽一个tick；第1级64个槽，每槽256个tick。
+tick为100ms时第0级覆盖25.6秒，第1级覆盖约27分钟，更远的定时器按最远处理。
+第0级转完一圈时把第1级对应槽中的定时器重新分配到第0级。
+时间轮只由所属的反应堆线程访问，不加锁。
+*/
+class timer_wheel
+{
+public:
+    typedef void (*expire_callback)(timer_node* node, void* arg);
+
+    explicit timer_wheel(long now_ms, int tick_ms = 100);
+
+    void add(timer_node* node, long timeout_ms);   //添加定时器，已在时间轮中则重新计时（刷新）
+    void remove(timer_node* node);                 //删除定时器，不在时间轮中时什么也不做
+    int next_timeout(long now_ms) const;           //距下一个tick的毫秒数，作为epoll_wait的超时；时间轮为空时返回-1
+    void advance(long now_ms, expire_callback cb, void* arg); //处理到now_ms为止到期的定时器，回调前节点已移出时间轮
+    void for_each(expire_callback cb, void* arg);  //对每个定时器调用cb（不改变到期时间），cb中只能删除或重新添加传入的节点
+    size_t size() const { return m_count; }
+
+private:
+    static const int L0_BITS = 8;
+    static const int L1_BITS = 6;
+    static const int L0_SIZE = 1 << L0_BITS;
+    static const int L1_SIZE = 1 << L1_BITS;
+
+    void link(timer_node* node);                   //按到期tick放入对应级别的槽
+    static void push(timer_node* head, timer_node* node);
+
+    timer_node m_l0[L0_SIZE];   //各槽的哨兵节点
+    timer_node m_l1[L1_SIZE];
+    long m_base_ms;             //第0个tick对应的时间
+    int m_tick_ms;
+    long m_current;             //下一个要处理的tick
+    size_t m_count;
+};
+
+#endif
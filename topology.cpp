@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <vector>
+
+#include "topology.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+
+// 解析"0-3,8,10-11"形式的CPU列表
+static bool parse_cpu_list( const char* s, cpu_set_t* set ){
+    CPU_ZERO( set );
+    const char* p = s;
+    while( *p ){
+        char* end;
+        long first = strtol( p, &end, 10 );
+        if( end == p || first < 0 ){
+            return false;
+        }
+        long last = first;
+        p = end;
+        if( *p == '-' ){
+            last = strtol( p + 1, &end, 10 );
+            if( end == p + 1 || last < first ){
+                return false;
+            }
+            p = end;
+        }
+        for( long c = first; c <= last && c < MAX_PLACEMENT_CPUS; c++ ){
+            CPU_SET( c, set );
+        }
+        if( *p == ',' ){
+            p++;
+        }
+        else if( *p != '\0' && *p != '\n' ){
+            return false;
+        }
+        else{
+            break;
+        }
+    }
+    return true;
+}
+
+// 读sysfs中每个节点的cpulist，没有NUMA信息（未开启CONFIG_NUMA）时所有CPU都在节点0
+static int read_nodes( int* node_of ){
+    memset( node_of, 0, sizeof( int ) * MAX_PLACEMENT_CPUS );
+    DIR* dir = opendir( NODE_DIR );
+    if( !dir ){
+        return 1;
+    }
+    int max_node = 0;
+    struct dirent* d;
+    while( ( d = readdir( dir ) ) ){
+        int node;
+        if( sscanf( d->d_name, "node%d", &node ) != 1 || node < 0 ){
+            continue;
+        }
+        char path[PATH_MAX];
+        int len = snprintf( path, sizeof( path ), NODE_DIR "/%s/cpulist", d->d_name );
+        if( len < 0 || ( size_t )len >= sizeof( path ) ){
+            continue;
+        }
+        FILE* fp = fopen( path, "r" );
+        if( !fp ){
+            continue;
+        }
+        char line[4096];
+        cpu_set_t set;
+        if( fgets( line, sizeof( line ), fp ) && parse_cpu_list( line, &set ) ){
+            for( int c = 0; c < MAX_PLACEMENT_CPUS; c++ ){
+                if( CPU_ISSET( c, &set ) ){
+                    node_of[c] = node;
+                }
+            }
+            if( node > max_node ){
+                max_node = node;
+            }
+        }
+        fclose( fp );
+    }
+    closedir( dir );
+    return max_node + 1;
+}
+
+bool load_topology( const char* spec, cpu_topology* topo ){
+    cpu_set_t allowed;
+    if( sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 ){
+        return false;
+    }
+    if( strcmp( spec, "auto" ) != 0 ){
+        cpu_set_t wanted;
+        if( !parse_cpu_list( spec, &wanted ) ){
+            return false;
+        }
+        CPU_AND( &allowed, &allowed, &wanted );
+    }
+    topo->node_count = read_nodes( topo->node_of );
+    // 每个节点一个CPU列表，再轮流从各节点取一个
+    std::vector< std::vector< int > > per_node( topo->node_count );
+    for( int c = 0; c < MAX_PLACEMENT_CPUS; c++ ){
+        if( CPU_ISSET( c, &allowed ) ){
+            per_node[ topo->node_of[c] ].push_back( c );
+        }
+    }
+    topo->cpu_count = 0;
+    for( size_t round = 0; ; round++ ){
+        bool any = false;
+        for( int n = 0; n < topo->node_count; n++ ){
+            if( round < per_node[n].size() ){
+                topo->order[ topo->cpu_count++ ] = per_node[n][round];
+                any = true;
+            }
+        }
+        if( !any ){
+            break;
+        }
+    }
+    return topo->cpu_count > 0;
+}
+
+void build_steering( const cpu_topology& topo, int thread_number, worker_steering* steer ){
+    steer->first.assign( MAX_PLACEMENT_CPUS + 1, 0 );
+    steer->workers.clear();
+    for( int c = 0; c < MAX_PLACEMENT_CPUS; c++ ){
+        steer->first[c] = steer->workers.size();
+        for( int w = 0; w < thread_number; w++ ){
+            if( topo.cpu( w ) == c ){
+                steer->workers.push_back( w );
+            }
+        }
+        if( ( int )steer->workers.size() == steer->first[c] ){
+            for( int w = 0; w < thread_number; w++ ){
+                if( topo.node( topo.cpu( w ) ) == topo.node( c ) ){
+                    steer->workers.push_back( w );
+                }
+            }
+        }
+    }
+    steer->first[ MAX_PLACEMENT_CPUS ] = steer->workers.size();
+}
+
+bool set_thread_cpu( pthread_attr_t* attr, int cpu ){
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return pthread_attr_setaffinity_np( attr, sizeof( set ), &set ) == 0;
+}
+
+bool pin_current_thread( int cpu, cpu_set_t* old_set ){
+    if( pthread_getaffinity_np( pthread_self(), sizeof( *old_set ), old_set ) != 0 ){
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+}
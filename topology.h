@@ -0,0 +1,56 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+
+/*
+CPU拓扑与线程放置：从sysfs读出每个CPU所属的NUMA节点（不依赖libnuma），
+把可用的CPU按节点交错排列（节点0的第1个CPU、节点1的第1个CPU、节点0的第2个CPU……），
+第i个线程绑定到order[i % cpu_count]，线程数少于CPU数时也均匀分布在各节点上。
+线程绑定后自己分配并首先访问的内存（连接对象、缓冲区、io_uring的环）按Linux默认的本地分配策略落在所在节点。
+*/
+
+#define MAX_PLACEMENT_CPUS 1024
+
+struct cpu_topology
+{
+    int cpu_count;                      //参与放置的CPU数
+    int order[MAX_PLACEMENT_CPUS];      //按节点交错排列的CPU编号
+    int node_count;
+    int node_of[MAX_PLACEMENT_CPUS];    //CPU编号到NUMA节点，没有NUMA信息时都是0
+
+    int cpu(int index) const {return order[ index % cpu_count ];}
+    int node(int cpu) const {return cpu >= 0 && cpu < MAX_PLACEMENT_CPUS ? node_of[cpu] : 0;}
+};
+
+// 线程池模式下的连接分配：第w个工作线程绑定在topo.cpu(w)上，
+// 握手在cpu上处理的连接交给同一CPU上的工作线程，没有时交给同一节点上的工作线程，同一CPU/节点上有多个时按key分散
+struct worker_steering
+{
+    std::vector< int > first;           //按CPU编号索引，cpu的候选工作线程是workers[first[cpu], first[cpu + 1])
+    std::vector< int > workers;
+
+    // 返回工作线程编号，cpu没有候选时返回-1
+    int pick(int cpu, unsigned key) const {
+        if( cpu < 0 || cpu + 1 >= ( int )first.size() || first[cpu] == first[cpu + 1] ){
+            return -1;
+        }
+        return workers[ first[cpu] + key % ( first[cpu + 1] - first[cpu] ) ];
+    }
+};
+
+// spec为"auto"（进程允许运行的所有CPU）或CPU列表如"0-3,8,10-11"，列表中不允许运行的CPU被忽略；
+// 解析失败或没有可用的CPU时返回false
+bool load_topology(const char* spec, cpu_topology* topo);
+
+void build_steering(const cpu_topology& topo, int thread_number, worker_steering* steer);
+
+// 设置线程属性，让新线程一开始就运行在cpu上（栈也在该节点上分配）
+bool set_thread_cpu(pthread_attr_t* attr, int cpu);
+
+// 把调用线程绑定到cpu，返回原来的CPU集合，用于在某个节点上临时分配内存后恢复
+bool pin_current_thread(int cpu, cpu_set_t* old_set);
+
+#endif
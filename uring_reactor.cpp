@@ -0,0 +1,776 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "uring_reactor.h"
+#include "topology.h"
+
+
+static int uring_setup( unsigned entries, io_uring_params* p )
+{
+    return ( int )syscall( __NR_io_uring_setup, entries, p );
+}
+
+static int uring_register( int fd, unsigned opcode, void* arg, unsigned nr_args )
+{
+    return ( int )syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+// 6.0开始支持SINGLE_ISSUER和多次recv，6.1开始支持DEFER_TASKRUN（完成事件只在本线程enter时处理，减少中断和唤醒）
+static int create_ring( unsigned entries, io_uring_params* p )
+{
+    memset( p, 0, sizeof( *p ) );
+    p->flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    int fd = uring_setup( entries, p );
+    if( fd < 0 && errno == EINVAL )
+    {
+        memset( p, 0, sizeof( *p ) );
+        p->flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER;
+        fd = uring_setup( entries, p );
+    }
+    return fd;
+}
+
+bool uring_reactor::supported()
+{
+    io_uring_params p;
+    int fd = create_ring( 8, &p );
+    if( fd < 0 )
+    {
+        return false;
+    }
+    bool ok = ( p.features & IORING_FEAT_EXT_ARG ) && ( p.features & IORING_FEAT_NODROP );
+
+    // 逐个确认用到的操作
+    size_t probe_size = sizeof( io_uring_probe ) + IORING_OP_LAST * sizeof( io_uring_probe_op );
+    io_uring_probe* probe = ( io_uring_probe* )calloc( 1, probe_size );
+    if( ok && uring_register( fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST ) == 0 )
+    {
+        const int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_PROVIDE_BUFFERS};
+        for( size_t i = 0; i < sizeof( ops ) / sizeof( ops[0] ); i++ )
+        {
+            if( ops[i] > probe->last_op || !( probe->ops[ ops[i] ].flags & IO_URING_OP_SUPPORTED ) )
+            {
+                ok = false;
+            }
+        }
+    }
+    else
+    {
+        ok = false;
+    }
+    free( probe );
+
+    close( fd );
+    return ok;
+}
+
+uring_reactor::uring_reactor( int id, int listenfd, const server_config& config )
+    : m_id( id ), m_listenfd( listenfd ), m_cpu( -1 ), m_max_conn( config.max_conn ), m_entries( config.uring_entries ), m_drain_timeout_ms( config.drain_timeout_ms ), m_draining( false ), m_drain_deadline( 0 ), m_ring_fd( -1 ), m_sq_ptr( MAP_FAILED ), m_sqes( ( io_uring_sqe* )MAP_FAILED ), m_cq_ptr( MAP_FAILED ),
+      m_buf_ring( ( io_uring_buf_ring* )MAP_FAILED ), m_ring_buffers( false ), m_buf_base( NULL ), m_buf_tail( 0 ), m_timers( metrics::now_ms() ), m_thread( 0 )
+{
+    set_timeouts( config.idle_timeout_ms, config.header_timeout_ms, config.write_timeout_ms );
+    m_stopfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+}
+
+uring_reactor::~uring_reactor()
+{
+    teardown();
+    if( m_stopfd >= 0 )
+    {
+        close( m_stopfd );
+    }
+}
+
+void uring_reactor::set_timeouts( int idle_ms, int header_ms, int write_ms )
+{
+    m_timeout_ms[ http_conn::TIMER_IDLE ] = idle_ms;
+    m_timeout_ms[ http_conn::TIMER_HEADER ] = header_ms;
+    m_timeout_ms[ http_conn::TIMER_WRITE ] = write_ms;
+}
+
+bool uring_reactor::start()
+{
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    if( m_cpu >= 0 )
+    {
+        set_thread_cpu( &attr, m_cpu );
+    }
+    bool ok = pthread_create( &m_thread, &attr, worker, this ) == 0;
+    pthread_attr_destroy( &attr );
+    return ok;
+}
+
+void uring_reactor::join()
+{
+    if( m_thread )
+    {
+        pthread_join( m_thread, NULL );
+        m_thread = 0;
+    }
+}
+
+void uring_reactor::stop()
+{
+    uint64_t one = 1;
+    ssize_t n = ::write( m_stopfd, &one, sizeof( one ) );
+    ( void )n;
+}
+
+void* uring_reactor::worker( void* arg )
+{
+    uring_reactor* r = ( uring_reactor* )arg;
+    r->loop();
+    return r;
+}
+
+bool uring_reactor::setup()
+{
+    io_uring_params p;
+    m_ring_fd = create_ring( m_entries, &p );
+    if( m_ring_fd < 0 )
+    {
+        return false;
+    }
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if( single )
+    {
+        m_sq_size = m_cq_size = m_sq_size > m_cq_size ? m_sq_size : m_cq_size;
+    }
+    m_sq_ptr = mmap( NULL, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING );
+    if( m_sq_ptr == MAP_FAILED )
+    {
+        return false;
+    }
+    m_cq_ptr = single ? m_sq_ptr : mmap( NULL, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING );
+    if( m_cq_ptr == MAP_FAILED )
+    {
+        return false;
+    }
+    m_sqes_size = p.sq_entries * sizeof( io_uring_sqe );
+    m_sqes = ( io_uring_sqe* )mmap( NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES );
+    if( m_sqes == MAP_FAILED )
+    {
+        return false;
+    }
+
+    char* sq = ( char* )m_sq_ptr;
+    m_sq_head = ( unsigned* )( sq + p.sq_off.head );
+    m_sq_tail = ( unsigned* )( sq + p.sq_off.tail );
+    m_sq_mask = *( unsigned* )( sq + p.sq_off.ring_mask );
+    m_sq_entries = p.sq_entries;
+    m_sq_local = m_sq_submitted = *m_sq_tail;
+    // 提交项与索引数组一一对应，只需要填一次
+    unsigned* array = ( unsigned* )( sq + p.sq_off.array );
+    for( unsigned i = 0; i < p.sq_entries; i++ )
+    {
+        array[i] = i;
+    }
+    char* cq = ( char* )m_cq_ptr;
+    m_cq_head = ( unsigned* )( cq + p.cq_off.head );
+    m_cq_tail = ( unsigned* )( cq + p.cq_off.tail );
+    m_cq_mask = *( unsigned* )( cq + p.cq_off.ring_mask );
+    m_cqes = ( io_uring_cqe* )( cq + p.cq_off.cqes );
+
+    m_buf_base = ( char* )malloc( ( size_t )URING_BUF_NUMBER * URING_BUF_SIZE );
+    if( !m_buf_base )
+    {
+        return false;
+    }
+    // 接收缓冲区环：环本身和各个缓冲区都由用户态分配，内核每次接收时取走一个，用完由recycle放回
+    m_buf_ring_size = URING_BUF_NUMBER * sizeof( io_uring_buf );
+    m_buf_ring = ( io_uring_buf_ring* )mmap( NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( m_buf_ring == MAP_FAILED )
+    {
+        return false;
+    }
+    io_uring_buf_reg reg;
+    memset( &reg, 0, sizeof( reg ) );
+    reg.ring_addr = ( unsigned long )m_buf_ring;
+    reg.ring_entries = URING_BUF_NUMBER;
+    reg.bgid = URING_BUF_GROUP;
+    m_ring_buffers = uring_register( m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) == 0;
+    if( m_ring_buffers )
+    {
+        for( int i = 0; i < URING_BUF_NUMBER; i++ )
+        {
+            recycle( i );
+        }
+        m_ring_buffers = test_buffer_ring();
+        if( !m_ring_buffers )
+        {
+            uring_register( m_ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1 );
+            printf( "uring reactor %d: provided buffer ring unusable, using IORING_OP_PROVIDE_BUFFERS\n", m_id );
+        }
+    }
+    if( !m_ring_buffers )
+    {
+        // 一次提交交出全部缓冲区，之后每个用完的缓冲区单独放回
+        io_uring_sqe* sqe = get_sqe( NULL, OP_NONE );
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = URING_BUF_NUMBER;
+        sqe->addr = ( unsigned long )m_buf_base;
+        sqe->len = URING_BUF_SIZE;
+        sqe->buf_group = URING_BUF_GROUP;
+        sqe->off = 0;
+    }
+    return true;
+}
+
+// 有的内核接受缓冲区环的注册，接收时却总是返回ENOBUFS：用一对本地socket实际收一次确认
+bool uring_reactor::test_buffer_ring()
+{
+    int sv[2];
+    if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv ) != 0 )
+    {
+        return false;
+    }
+    bool ok = false;
+    if( ::write( sv[1], "x", 1 ) == 1 )
+    {
+        io_uring_sqe* sqe = get_sqe( NULL, OP_NONE );
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUF_GROUP;
+        if( enter( 1, 1000 ) >= 0 && *m_cq_head != __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) )
+        {
+            io_uring_cqe* cqe = &m_cqes[ *m_cq_head & m_cq_mask ];
+            ok = cqe->res == 1;
+            if( cqe->flags & IORING_CQE_F_BUFFER )
+            {
+                recycle( cqe->flags >> IORING_CQE_BUFFER_SHIFT );
+            }
+            __atomic_store_n( m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE );
+        }
+    }
+    close( sv[0] );
+    close( sv[1] );
+    return ok;
+}
+
+void uring_reactor::teardown()
+{
+    if( m_ring_fd >= 0 )
+    {
+        close( m_ring_fd );
+        m_ring_fd = -1;
+    }
+    if( m_sqes != MAP_FAILED )
+    {
+        munmap( m_sqes, m_sqes_size );
+        m_sqes = ( io_uring_sqe* )MAP_FAILED;
+    }
+    if( m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr )
+    {
+        munmap( m_cq_ptr, m_cq_size );
+    }
+    m_cq_ptr = MAP_FAILED;
+    if( m_sq_ptr != MAP_FAILED )
+    {
+        munmap( m_sq_ptr, m_sq_size );
+        m_sq_ptr = MAP_FAILED;
+    }
+    if( m_buf_ring != MAP_FAILED )
+    {
+        munmap( m_buf_ring, m_buf_ring_size );
+        m_buf_ring = ( io_uring_buf_ring* )MAP_FAILED;
+    }
+    free( m_buf_base );
+    m_buf_base = NULL;
+}
+
+void uring_reactor::recycle( int bid )
+{
+    if( !m_ring_buffers )
+    {
+        // 放回缓冲区的提交随下一次enter一起交给内核，不额外产生系统调用
+        io_uring_sqe* sqe = get_sqe( NULL, OP_NONE );
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = ( unsigned long )( m_buf_base + ( size_t )bid * URING_BUF_SIZE );
+        sqe->len = URING_BUF_SIZE;
+        sqe->buf_group = URING_BUF_GROUP;
+        sqe->off = bid;
+        return;
+    }
+    io_uring_buf* buf = &m_buf_ring->bufs[ m_buf_tail & ( URING_BUF_NUMBER - 1 ) ];
+    buf->addr = ( unsigned long )( m_buf_base + ( size_t )bid * URING_BUF_SIZE );
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    m_buf_tail++;
+    __atomic_store_n( &m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE );
+}
+
+io_uring_sqe* uring_reactor::get_sqe( uring_conn* uc, OP op )
+{
+    if( m_sq_local - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE ) >= m_sq_entries )
+    {
+        enter( 0, -1 ); // 提交队列满，先交给内核
+    }
+    io_uring_sqe* sqe = &m_sqes[ m_sq_local & m_sq_mask ];
+    m_sq_local++;
+    memset( sqe, 0, sizeof( *sqe ) );
+    sqe->user_data = ( unsigned long )uc | op;
+    return sqe;
+}
+
+int uring_reactor::enter( unsigned wait_nr, int timeout_ms )
+{
+    __atomic_store_n( m_sq_tail, m_sq_local, __ATOMIC_RELEASE );
+    unsigned to_submit = m_sq_local - m_sq_submitted;
+    struct __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset( &arg, 0, sizeof( arg ) );
+    if( timeout_ms >= 0 )
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+        arg.ts = ( unsigned long )&ts;
+    }
+    arg.sigmask_sz = _NSIG / 8;
+    // 总是带上GETEVENTS：DEFER_TASKRUN下完成事件只在这时处理
+    int ret = ( int )syscall( __NR_io_uring_enter, m_ring_fd, to_submit, wait_nr,
+                              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof( arg ) );
+    if( ret < 0 )
+    {
+        return -errno;
+    }
+    m_sq_submitted += ret;
+    return ret;
+}
+
+// 循环提交、等待、收割完成事件
+void uring_reactor::loop()
+{
+    if( !setup() )
+    {
+        printf( "uring reactor %d: io_uring setup failure\n", m_id );
+        teardown();
+        return;
+    }
+    arm_accept();
+    if( m_stopfd >= 0 )
+    {
+        io_uring_sqe* sqe = get_sqe( NULL, OP_STOP );
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_stopfd;
+        sqe->poll32_events = POLLIN;
+    }
+    while( !m_draining || m_conns.used() > 0 )
+    {
+        // 完成队列中还有事件时不等待；有连接时最多睡到下一个tick，以便及时处理超时
+        bool ready = __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) != *m_cq_head;
+        int timeout = m_timers.next_timeout( metrics::now_ms() );
+        if( m_draining && ( timeout < 0 || timeout > DRAIN_POLL_MS ) )
+        {
+            timeout = DRAIN_POLL_MS; // 排空时定期检查截止时间
+        }
+        int ret = enter( ready ? 0 : 1, timeout );
+        if( ret < 0 && ret != -ETIME && ret != -EINTR && ret != -EBUSY )
+        {
+            printf( "uring reactor %d: io_uring_enter failure %d\n", m_id, -ret );
+            break;
+        }
+        if( m_timers.size() == 0 )
+        {
+            // 时间轮为空时可能睡了很久，先把时间轮拨到当前时间，本轮新添加的定时器才能从现在算起
+            m_timers.advance( metrics::now_ms(), on_timeout, this );
+        }
+        reap();
+        // 定时器放在完成事件之后处理，关闭连接不会影响本轮尚未处理的事件
+        m_timers.advance( metrics::now_ms(), on_timeout, this );
+        if( m_draining && metrics::now_ms() >= m_drain_deadline )
+        {
+            m_timers.for_each( close_quiet, this );
+        }
+    }
+}
+
+void uring_reactor::drain()
+{
+    m_draining = true;
+    m_drain_deadline = metrics::now_ms() + m_drain_timeout_ms;
+    // 取消监听socket上的多次accept，监听socket由main关闭或已交给新进程
+    io_uring_sqe* sqe = get_sqe( NULL, OP_NONE );
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = ( unsigned long )OP_ACCEPT;
+    // 之后发完响应变为空闲的连接在下一个tick关闭
+    m_timeout_ms[ http_conn::TIMER_IDLE ] = 0;
+    m_timers.for_each( close_idle, this );
+}
+
+void uring_reactor::close_idle( timer_node* node, void* arg )
+{
+    uring_reactor* r = ( uring_reactor* )arg;
+    uring_conn* uc = ( uring_conn* )node->data;
+    http_conn& conn = uc->conn;
+    if( uc->sending || uc->unparsed || !uc->spill.empty() || conn.writing() || conn.parse_pending() )
+    {
+        return;
+    }
+    // keep-alive空闲连接，或者还没有收到请求的任何字节的新连接；请求已经到达socket但还没读入的不关闭，否则客户端会收到RST
+    if( ( conn.m_timer_kind == http_conn::TIMER_IDLE || conn.m_read_idx == conn.m_request_start ) && !conn.input_pending() )
+    {
+        r->close_conn( uc );
+    }
+}
+
+void uring_reactor::close_quiet( timer_node* node, void* arg )
+{
+    uring_reactor* r = ( uring_reactor* )arg;
+    r->close_conn( ( uring_conn* )node->data );
+}
+
+void uring_reactor::reap()
+{
+    unsigned head = *m_cq_head;
+    while( head != __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) )
+    {
+        io_uring_cqe* cqe = &m_cqes[ head & m_cq_mask ];
+        unsigned long data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        // 先归还完成项，处理过程中提交新的请求不会占用这个位置
+        __atomic_store_n( m_cq_head, ++head, __ATOMIC_RELEASE );
+
+        uring_conn* uc = ( uring_conn* )( data & ~7UL );
+        switch( data & 7 )
+        {
+            case OP_ACCEPT:
+                on_accept( res, flags );
+                break;
+            case OP_RECV:
+                on_recv( uc, res, flags );
+                break;
+            case OP_SEND:
+                on_send( uc, res );
+                break;
+            case OP_POLL:
+                on_poll( uc );
+                break;
+            case OP_STOP:
+                drain();
+                break;
+            default: // 取消请求、放回缓冲区等不需要处理的完成事件
+                break;
+        }
+    }
+}
+
+void uring_reactor::arm_accept()
+{
+    io_uring_sqe* sqe = get_sqe( NULL, OP_ACCEPT );
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void uring_reactor::arm_recv( uring_conn* uc )
+{
+    io_uring_sqe* sqe = get_sqe( uc, OP_RECV );
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc->conn.m_sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    uc->receiving = true;
+    uc->cancelling = false;
+    uc->inflight++;
+}
+
+void uring_reactor::on_accept( int res, unsigned flags )
+{
+    if( !( flags & IORING_CQE_F_MORE ) && !m_draining )
+    {
+        arm_accept(); // 多次accept因错误终止，重新提交
+    }
+    if( res == -ECANCELED && m_draining )
+    {
+        return;
+    }
+    if( res < 0 )
+    {
+        printf( "errno is: %d\n", -res );
+        return;
+    }
+    int connfd = res;
+    uring_conn* uc = NULL;
+    if( http_conn::m_user_count >= m_max_conn || !( uc = m_conns.alloc() ) )
+    {
+        metrics::add( COUNTER_REJECTS );
+        shed_connection( connfd );
+        return;
+    }
+    metrics::add( COUNTER_ACCEPTS );
+    // 多次accept不回传对端地址，访问日志需要时再取
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof( client_address );
+    memset( &client_address, 0, sizeof( client_address ) );
+    getpeername( connfd, ( struct sockaddr* )&client_address, &client_addrlength );
+    uc->conn.init( connfd, client_address, -1, &m_buffers ); // 不注册epoll
+    arm_recv( uc );
+    arm( uc, http_conn::TIMER_HEADER ); // 新连接要在限定时间内发来第一个请求
+}
+
+void uring_reactor::on_recv( uring_conn* uc, int res, unsigned flags )
+{
+    if( !( flags & IORING_CQE_F_MORE ) )
+    {
+        uc->receiving = false;
+        uc->inflight--;
+    }
+    const char* data = NULL;
+    int bid = -1;
+    if( flags & IORING_CQE_F_BUFFER )
+    {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        data = m_buf_base + ( size_t )bid * URING_BUF_SIZE;
+    }
+    if( uc->closing )
+    {
+        if( bid >= 0 )
+        {
+            recycle( bid );
+        }
+        close_conn( uc );
+        return;
+    }
+    if( res <= 0 )
+    {
+        // 接收缓冲区用完（ENOBUFS）或被暂停（ECANCELED）时只是多次接收终止了，由pump重新提交；
+        // 对方关闭连接或其他错误则关闭
+        if( res == -ENOBUFS || res == -ECANCELED )
+        {
+            pump( uc, false );
+        }
+        else
+        {
+            close_conn( uc );
+        }
+        return;
+    }
+
+    http_conn& conn = uc->conn;
+    int n = 0;
+    if( uc->spill.empty() )
+    {
+        n = conn.fill( data, res );
+        if( n < 0 )
+        {
+            recycle( bid );
+            close_conn( uc );
+            return;
+        }
+    }
+    if( n < res )
+    {
+        uc->spill.append( data + n, res - n );
+    }
+    recycle( bid );
+    uc->unparsed = uc->unparsed || n > 0;
+    // 新请求的第一批数据到达时开始计算请求读取超时，同一个请求后续的数据不刷新
+    if( conn.m_timer_kind != http_conn::TIMER_HEADER )
+    {
+        arm( uc, http_conn::TIMER_HEADER );
+    }
+    // 客户端一直发送却不读响应时暂停接收，让TCP的流量控制起作用
+    if( uc->spill.size() > URING_SPILL_LIMIT && uc->receiving && !uc->cancelling )
+    {
+        io_uring_sqe* sqe = get_sqe( NULL, OP_NONE );
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = ( unsigned long )uc | OP_RECV;
+        uc->cancelling = true;
+    }
+    pump( uc, false );
+}
+
+void uring_reactor::on_send( uring_conn* uc, int res )
+{
+    uc->sending = false;
+    uc->inflight--;
+    if( uc->closing )
+    {
+        close_conn( uc );
+        return;
+    }
+    http_conn& conn = uc->conn;
+    if( res == -EAGAIN )
+    {
+        // 发送缓冲区满，等待可写后重新发送
+        metrics::add( COUNTER_EPOLLOUT_REARMS );
+        io_uring_sqe* sqe = get_sqe( uc, OP_POLL );
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = conn.m_sockfd;
+        sqe->poll32_events = POLLOUT;
+        uc->sending = true;
+        uc->inflight++;
+        return;
+    }
+    if( res <= 0 || !conn.advance( res ) )
+    {
+        close_conn( uc );
+        return;
+    }
+    if( conn.writing() )
+    {
+        arm( uc, http_conn::TIMER_WRITE ); // 有进展，重新计算写超时
+    }
+    pump( uc, !conn.writing() );
+}
+
+void uring_reactor::on_poll( uring_conn* uc )
+{
+    uc->sending = false;
+    uc->inflight--;
+    if( uc->closing )
+    {
+        close_conn( uc );
+        return;
+    }
+    pump( uc, false );
+}
+
+bool uring_reactor::send( uring_conn* uc )
+{
+    http_conn& conn = uc->conn;
+    if( !conn.sending_file() )
+    {
+        // 响应头和内存中的内容拼成一次sendmsg，完成之前iov和msg都不能改动
+        bool more = false;
+        memset( &uc->msg, 0, sizeof( uc->msg ) );
+        uc->msg.msg_iov = uc->iov;
+        uc->msg.msg_iovlen = conn.gather( uc->iov, &more );
+        io_uring_sqe* sqe = get_sqe( uc, OP_SEND );
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn.m_sockfd;
+        sqe->addr = ( unsigned long )&uc->msg;
+        sqe->len = 1;
+        sqe->msg_flags = more ? MSG_MORE : 0; // 后面紧跟sendfile时让响应头和文件开头合并成满的报文段
+        uc->sending = true;
+        uc->inflight++;
+        return true;
+    }
+    // io_uring没有sendfile操作，大文件直接用sendfile零拷贝发送，发送缓冲区满时提交poll等待可写
+    ssize_t n = conn.send_file();
+    if( n < 0 && errno == EAGAIN )
+    {
+        metrics::add( COUNTER_EPOLLOUT_REARMS );
+        io_uring_sqe* sqe = get_sqe( uc, OP_POLL );
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = conn.m_sockfd;
+        sqe->poll32_events = POLLOUT;
+        uc->sending = true;
+        uc->inflight++;
+        return true;
+    }
+    if( n <= 0 || !conn.advance( n ) )
+    {
+        close_conn( uc );
+        return false;
+    }
+    if( conn.writing() )
+    {
+        arm( uc, http_conn::TIMER_WRITE );
+    }
+    return true;
+}
+
+void uring_reactor::pump( uring_conn* uc, bool idle )
+{
+    http_conn& conn = uc->conn;
+    while( !uc->sending )
+    {
+        if( conn.writing() )
+        {
+            if( !send( uc ) )
+            {
+                return;
+            }
+            idle = !conn.writing();
+            continue;
+        }
+        if( uc->unparsed || conn.parse_pending() )
+        {
+            uc->unparsed = false;
+            conn.process();
+            if( conn.writing() )
+            {
+                idle = false;
+            }
+            continue;
+        }
+        if( !uc->spill.empty() )
+        {
+            // 上一批请求已处理完，把暂存的数据移进读缓冲区；移不进去说明一个请求超过了读缓冲区
+            int n = conn.fill( uc->spill.data(), uc->spill.size() );
+            if( n <= 0 )
+            {
+                close_conn( uc );
+                return;
+            }
+            uc->spill.erase( 0, n );
+            uc->unparsed = true;
+            continue;
+        }
+        break;
+    }
+    if( !uc->receiving && uc->spill.size() <= URING_SPILL_LIMIT )
+    {
+        arm_recv( uc ); // 多次接收已终止（缓冲区用完或被暂停），重新提交
+    }
+    if( idle && !conn.writing() && !conn.parse_pending() )
+    {
+        conn.release_buffers(); // 空闲的keep-alive连接不占用缓冲区
+        arm( uc, http_conn::TIMER_IDLE ); // 响应发完，等待keep-alive连接上的下一个请求
+    }
+}
+
+void uring_reactor::close_conn( uring_conn* uc )
+{
+    if( !uc->closing )
+    {
+        uc->closing = true;
+        m_timers.remove( &uc->conn.m_timer );
+        if( uc->inflight > 0 )
+        {
+            // 取消该socket上所有未完成的提交，它们的完成事件都到达后才能关闭socket、释放连接
+            io_uring_sqe* sqe = get_sqe( NULL, OP_NONE );
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = uc->conn.m_sockfd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        }
+    }
+    if( uc->inflight == 0 )
+    {
+        uc->conn.close_conn();
+        m_conns.free( uc );
+    }
+}
+
+void uring_reactor::arm( uring_conn* uc, http_conn::TIMER_KIND kind )
+{
+    uc->conn.m_timer_kind = kind;
+    uc->conn.m_timer.data = uc;
+    m_timers.add( &uc->conn.m_timer, m_timeout_ms[kind] );
+}
+
+void uring_reactor::on_timeout( timer_node* node, void* arg )
+{
+    uring_reactor* r = ( uring_reactor* )arg;
+    uring_conn* uc = ( uring_conn* )node->data;
+    metrics::add( ( COUNTER_ID )( COUNTER_TIMEOUT_IDLE + uc->conn.m_timer_kind ) );
+    r->close_conn( uc );
+}
@@ -0,0 +1,137 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <pthread.h>
+#include <string>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "reactor.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+#include "slab.h"
+
+#define URING_BUF_NUMBER 1024       //交给内核的接收缓冲区个数（2的幂），多次接收时由内核从中挑选
+#define URING_BUF_SIZE 4096         //每个接收缓冲区的大小
+#define URING_BUF_GROUP 0           //接收缓冲区所属的组
+#define URING_SPILL_LIMIT 65536     //读缓冲区放不下的数据超过这么多时暂停接收，等响应发出去再继续
+
+/*
+io_uring引擎中的一个连接：http_conn加上引擎自己的状态
+*/
+struct uring_conn
+{
+    http_conn conn;
+    std::string spill;                      //已收到但读缓冲区放不下的数据
+    struct iovec iov[ http_conn::MAX_IOV ]; //正在进行的sendmsg引用它们，完成之前不能改动
+    struct msghdr msg;
+    int inflight;                           //尚未完成的提交数，为0时才能释放连接
+    bool receiving;                         //多次接收仍然有效
+    bool cancelling;                        //已请求取消多次接收（暂停接收）
+    bool sending;                           //sendmsg或等待可写尚未完成
+    bool unparsed;                          //读缓冲区中有还没交给process()的新数据
+    bool closing;                           //已决定关闭，等待inflight归零
+
+    uring_conn() : inflight( 0 ), receiving( false ), cancelling( false ), sending( false ), unparsed( false ), closing( false ) {}
+};
+
+/*
+io_uring反应堆：与reactor相同的http_conn解析/响应逻辑，换成io_uring驱动（不依赖liburing，直接使用系统调用）
+- 监听socket上一个多次accept，持续产生新连接
+- 每个连接一个多次recv，数据放在内核从缓冲区环中挑选的接收缓冲区里，拷入连接的读缓冲区后立即归还；
+  缓冲区环不可用时退回IORING_OP_PROVIDE_BUFFERS
+- 响应头和内存中的文件内容用sendmsg提交，大文件用sendfile就地发送，发不动时提交poll等待可写
+- 每轮一次io_uring_enter完成提交和等待，批量收割完成事件；请求在本线程内就地处理，不使用线程池
+- stop()写入eventfd，事件循环在其上的poll完成后取消多次accept，与reactor一样关闭空闲连接、排空其余连接后返回
+需要6.0及以上的内核，supported()探测失败时由main退回epoll。
+*/
+class uring_reactor
+{
+public:
+    static bool supported();        //探测内核是否支持本引擎用到的全部特性
+
+    uring_reactor(int id, int listenfd, const server_config& config);
+    ~uring_reactor();
+
+    void loop();                    //事件循环，io_uring实例在运行循环的线程中创建
+    bool start();                   //在新线程中运行事件循环
+    void join();                    //等待事件循环线程退出
+    void stop();                    //可在任意线程调用，通知事件循环排空连接后退出
+    void set_cpu(int cpu) {m_cpu = cpu;}    //start()之前调用，事件循环线程绑定到cpu，环也就建在它的节点上
+    void set_timeouts(int idle_ms, int header_ms, int write_ms);
+    size_t connections() const {return m_conns.used();}     //本反应堆的在线连接数
+
+private:
+    // 提交的类型放在user_data的低3位，其余位是连接的地址
+    enum OP {OP_NONE = 0, OP_ACCEPT, OP_RECV, OP_SEND, OP_POLL, OP_STOP};
+
+    bool setup();                   //创建io_uring实例，映射各个环并注册接收缓冲区环
+    bool test_buffer_ring();        //确认缓冲区环确实可用
+    void teardown();
+    io_uring_sqe* get_sqe(uring_conn* uc, OP op);    //取一个空的提交项，提交队列满时先提交一次
+    int enter(unsigned wait_nr, int timeout_ms);     //提交所有新的提交项，wait_nr>0时最多等待timeout_ms
+    void reap();                    //处理完成队列中所有的完成事件
+    void recycle(int bid);          //把接收缓冲区还给内核
+
+    void arm_accept();
+    void arm_recv(uring_conn* uc);
+    void on_accept(int res, unsigned flags);
+    void on_recv(uring_conn* uc, int res, unsigned flags);
+    void on_send(uring_conn* uc, int res);
+    void on_poll(uring_conn* uc);
+    void pump(uring_conn* uc, bool idle);   //处理已收到的请求并发送响应，idle表示刚发完一批响应
+    bool send(uring_conn* uc);      //发送排队的响应，返回false表示连接已关闭
+    void close_conn(uring_conn* uc);//删除定时器，等所有提交完成后关闭连接并释放连接对象
+    void arm(uring_conn* uc, http_conn::TIMER_KIND kind);
+    static void on_timeout(timer_node* node, void* arg);
+    void drain();                   //停止accept并关闭空闲连接
+    static void close_idle(timer_node* node, void* arg);
+    static void close_quiet(timer_node* node, void* arg);
+    static void* worker(void* arg);
+
+private:
+    int m_id;
+    int m_listenfd;
+    int m_stopfd;                   //stop()写入的eventfd
+    int m_cpu;                      //事件循环线程绑定的CPU，-1表示不绑定
+    int m_max_conn;                 //所有反应堆合计的在线连接上限
+    int m_entries;                  //提交队列长度，完成队列是它的两倍
+    int m_drain_timeout_ms;
+    bool m_draining;
+    long m_drain_deadline;
+    int m_ring_fd;
+    // 提交队列
+    void* m_sq_ptr;
+    size_t m_sq_size;
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sq_local;            //本地的队尾，enter时才写回共享的队尾
+    unsigned m_sq_submitted;        //已经交给内核的提交项数
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    // 完成队列
+    void* m_cq_ptr;
+    size_t m_cq_size;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe* m_cqes;
+    // 接收缓冲区环
+    io_uring_buf_ring* m_buf_ring;
+    size_t m_buf_ring_size;
+    bool m_ring_buffers;            //false时用IORING_OP_PROVIDE_BUFFERS逐个放回缓冲区
+    char* m_buf_base;
+    unsigned short m_buf_tail;
+
+    slab<uring_conn> m_conns;       //本反应堆的连接对象，user_data指向它们
+    buffer_pool m_buffers;          //本反应堆连接借用的读写缓冲区
+    timer_wheel m_timers;           //本反应堆所有连接的超时定时器
+    int m_timeout_ms[3];            //各类超时的时长，按TIMER_KIND索引
+    pthread_t m_thread;
+};
+
+#endif